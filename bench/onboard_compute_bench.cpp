@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <model_pipeline.h>
+#include <resize.h>
+#include <tensor_preprocess.h>
+
+#include "dense_encode.h"
+#include "detection_buffer.h"
+#include "detection_log.h"
+#include "result_encode.h"
+#include "result_filter.h"
+#include "onboard_compute.pb.h"
+
+// Component microbenchmarks. Each result is one JSON object per line so runs
+// from different builds or machines can be diffed or loaded directly:
+//
+//   {"benchmark":"resize_gray","params":"1280x720->300x300","iterations":2048,
+//    "ns_per_iter":..., "ns_per_iter_min":..., "mb_per_s":...}
+//
+// ns_per_iter is the median over --repetitions batches, each at least
+// --min-time-ms long. Inputs come from a fixed seed, so runs are comparable.
+
+using namespace std;
+using namespace steeleagle;
+
+//-----------------------------------------------------------------------------
+
+struct BenchOptions {
+    string filter;
+    int min_time_ms = 200;
+    int repetitions = 5;
+    string detection_log;
+};
+
+static BenchOptions options;
+
+//-----------------------------------------------------------------------------
+
+// Keeps the compiler from discarding a result the benchmark never reads
+static inline void keep(const void* p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+//-----------------------------------------------------------------------------
+
+static vector<uint8_t> random_bytes(size_t n, uint32_t seed) {
+    vector<uint8_t> bytes(n);
+    uint32_t state = seed;
+    for (size_t i = 0; i < n; i++) {
+        state = state * 1664525u + 1013904223u;
+        bytes[i] = state >> 24;
+    }
+    return bytes;
+}
+
+//-----------------------------------------------------------------------------
+
+static void run_benchmark(const string& name, const string& params, size_t bytes_per_iter,
+                          const function<void()>& body) {
+    if (!options.filter.empty() && (name + "/" + params).find(options.filter) == string::npos) {
+        return;
+    }
+
+    // Size a batch to the minimum time from a short calibration run
+    body();
+    uint64_t iterations = 1;
+    while (true) {
+        int64_t start_ns = monotonic_time_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            body();
+        }
+        int64_t elapsed_ns = monotonic_time_ns() - start_ns;
+        if (elapsed_ns >= options.min_time_ms * 1000000LL / 10 || iterations >= (1ULL << 30)) {
+            double scale = options.min_time_ms * 1e6 / max<int64_t>(elapsed_ns, 1);
+            iterations = max<uint64_t>(1, (uint64_t)(iterations * scale));
+            break;
+        }
+        iterations *= 2;
+    }
+
+    vector<double> ns_per_iter;
+    for (int r = 0; r < options.repetitions; r++) {
+        int64_t start_ns = monotonic_time_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            body();
+        }
+        ns_per_iter.push_back((double)(monotonic_time_ns() - start_ns) / iterations);
+    }
+    sort(ns_per_iter.begin(), ns_per_iter.end());
+    double median = ns_per_iter[ns_per_iter.size() / 2];
+
+    printf("{\"benchmark\":\"%s\",\"params\":\"%s\",\"iterations\":%llu,"
+           "\"ns_per_iter\":%.1f,\"ns_per_iter_min\":%.1f,\"mb_per_s\":%.1f}\n",
+           name.c_str(), params.c_str(), (unsigned long long)iterations, median, ns_per_iter.front(),
+           bytes_per_iter ? bytes_per_iter * 1e3 / median : 0.0);
+    fflush(stdout);
+}
+
+//-----------------------------------------------------------------------------
+
+struct ResizeCase {
+    int w_in;
+    int h_in;
+    int w_out;
+    int h_out;
+};
+
+static const ResizeCase kResizeCases[] = {
+    {640, 480, 320, 240},
+    {1280, 720, 300, 300},
+    {1920, 1080, 640, 640},
+    {4056, 3040, 640, 480},
+};
+
+static string size_params(const ResizeCase& c) {
+    char params[64];
+    snprintf(params, sizeof(params), "%dx%d->%dx%d", c.w_in, c.h_in, c.w_out, c.h_out);
+    return params;
+}
+
+//-----------------------------------------------------------------------------
+
+static void bench_resize() {
+    for (const ResizeCase& c : kResizeCases) {
+        undistort_map_t map;
+        if (mcv_init_resize_map(c.w_in, c.h_in, c.w_out, c.h_out, &map)) {
+            continue;
+        }
+        vector<uint8_t> input = random_bytes((size_t)c.w_in * c.h_in * 3, 1);
+        vector<uint8_t> output((size_t)c.w_out * c.h_out * 3);
+
+        run_benchmark("resize_gray", size_params(c), (size_t)c.w_in * c.h_in, [&] {
+            mcv_resize_image(input.data(), output.data(), &map);
+            keep(output.data());
+        });
+        run_benchmark("resize_rgb", size_params(c), (size_t)c.w_in * c.h_in * 3, [&] {
+            mcv_resize_8uc3_image(input.data(), output.data(), &map);
+            keep(output.data());
+        });
+        run_benchmark("resize_yuv422", size_params(c), (size_t)c.w_in * c.h_in * 2, [&] {
+            mcv_resize_yuv422_image(input.data(), output.data(), &map);
+            keep(output.data());
+        });
+        mcv_free_resize_map(&map);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+// Hand built TFLite_Detection_PostProcess outputs of ssd_mobilenet_v2, as the
+// interpreter would leave them after a busy frame
+struct SsdOutputs {
+    static const int kDetections = SsdMobilenetV2::kMaxDetections;
+
+    SsdOutputs() : boxes(kDetections * 4), classes(kDetections), scores(kDetections), count(1) {
+        vector<uint8_t> noise = random_bytes(kDetections * 4, 5);
+        for (int i = 0; i < kDetections; i++) {
+            boxes[4 * i + 0] = noise[4 * i] / 512.0f;
+            boxes[4 * i + 1] = noise[4 * i + 1] / 512.0f;
+            boxes[4 * i + 2] = boxes[4 * i] + 0.25f;
+            boxes[4 * i + 3] = boxes[4 * i + 1] + 0.25f;
+            classes[i] = noise[4 * i + 2] % 90;
+            scores[i] = noise[4 * i + 3] / 255.0f;
+        }
+        count[0] = kDetections;
+
+        set_tensor(tensors_storage[0], boxes_dims, {1, kDetections, 4}, boxes.data());
+        set_tensor(tensors_storage[1], classes_dims, {1, kDetections}, classes.data());
+        set_tensor(tensors_storage[2], scores_dims, {1, kDetections}, scores.data());
+        set_tensor(tensors_storage[3], count_dims, {1}, count.data());
+        for (int i = 0; i < 4; i++) {
+            tensors[i] = &tensors_storage[i];
+        }
+    }
+
+    static void set_tensor(TfLiteTensor& tensor, vector<int>& dims_storage, const vector<int>& shape,
+                           float* data) {
+        dims_storage.assign(1, shape.size());
+        dims_storage.insert(dims_storage.end(), shape.begin(), shape.end());
+        tensor = TfLiteTensor();
+        tensor.type = kTfLiteFloat32;
+        tensor.dims = reinterpret_cast<TfLiteIntArray *>(dims_storage.data());
+        tensor.data.f = data;
+    }
+
+    vector<float> boxes;
+    vector<float> classes;
+    vector<float> scores;
+    vector<float> count;
+    vector<int> boxes_dims;
+    vector<int> classes_dims;
+    vector<int> scores_dims;
+    vector<int> count_dims;
+    TfLiteTensor tensors_storage[4];
+    const TfLiteTensor* tensors[4];
+};
+
+//-----------------------------------------------------------------------------
+
+static void bench_preprocess() {
+    const ResizeCase c = {1280, 720, 300, 300};
+    const NormalizationType norms[] = {NONE, PIXEL_MEAN, HARD_DIVISION};
+    const char* norm_names[] = {"NONE", "PIXEL_MEAN", "HARD_DIVISION"};
+    const TfLiteType types[] = {kTfLiteUInt8, kTfLiteInt8, kTfLiteFloat32};
+    const char* type_names[] = {"uint8", "int8", "float32"};
+    const int formats[] = {IMAGE_FORMAT_YUV422, IMAGE_FORMAT_NV12, IMAGE_FORMAT_RGB};
+    const char* format_names[] = {"yuv422", "nv12", "rgb"};
+
+    undistort_map_t map;
+    if (mcv_init_resize_map(c.w_in, c.h_in, c.w_out, c.h_out, &map)) {
+        return;
+    }
+    vector<uint8_t> frame = random_bytes((size_t)c.w_in * c.h_in * 3, 2);
+    vector<float> tensor_data((size_t)c.w_out * c.h_out * 3);
+
+    // Hand built NHWC tensor, only the fields the preprocessor reads
+    vector<int> dims_storage(1 + 4);
+    TfLiteIntArray* dims = reinterpret_cast<TfLiteIntArray *>(dims_storage.data());
+    dims->size = 4;
+    dims->data[0] = 1;
+    dims->data[1] = c.h_out;
+    dims->data[2] = c.w_out;
+    dims->data[3] = 3;
+
+    for (int f = 0; f < 3; f++) {
+        camera_image_metadata_t meta = {};
+        meta.width = c.w_in;
+        meta.height = c.h_in;
+        meta.format = formats[f];
+
+        for (int t = 0; t < 3; t++) {
+            for (int n = 0; n < 3; n++) {
+                TfLiteTensor input = {};
+                input.type = types[t];
+                input.dims = dims;
+                input.params.scale = types[t] == kTfLiteFloat32 ? 0.0f : 1.0f / 128;
+                input.params.zero_point = types[t] == kTfLiteInt8 ? 0 : 128;
+                input.data.data = tensor_data.data();
+
+                InputTensorPreprocessor preprocessor;
+                if (!preprocessor.init(&input, norms[n])) {
+                    continue;
+                }
+                string params = string(format_names[f]) + "/" + type_names[t] + "/" + norm_names[n] +
+                                "/" + size_params(c);
+                run_benchmark("preprocess", params, (size_t)c.w_out * c.h_out * 3, [&] {
+                    preprocessor.run(meta, frame.data(), &map, &input);
+                    keep(tensor_data.data());
+                });
+            }
+        }
+
+        // The pipeline voxl-tflite-server selects for SSD, same case as uint8/NONE above,
+        // with the quantization ssdlite_mobilenet_v2_coco ships
+        TfLiteTensor input = {};
+        input.type = kTfLiteUInt8;
+        input.dims = dims;
+        input.params.scale = 1.0f / 128;
+        input.params.zero_point = 128;
+        input.data.data = tensor_data.data();
+        SsdOutputs outputs;
+        unique_ptr<ModelPipeline> pipeline = create_model_pipeline(
+            "ssdlite_mobilenet_v2_coco.tflite", NONE, &input, outputs.tensors, 4);
+        if (pipeline && formats[f] == IMAGE_FORMAT_RGB) {
+            // The generic path resizes RGB and copies it into the tensor as is,
+            // so the specialized tensor must hold the same bytes
+            vector<uint8_t> generic((size_t)c.w_out * c.h_out * 3);
+            mcv_resize_8uc3_image(frame.data(), generic.data(), &map);
+            pipeline->preprocess(meta, frame.data(), &map, &input);
+            size_t probe = generic.size() / 2;
+            int specialized = input.data.uint8[probe];
+            if (specialized != generic[probe]) {
+                fprintf(stderr, "ERROR: specialized preprocess wrote %d where the generic path has %d\n",
+                        specialized, generic[probe]);
+                pipeline.reset();
+            }
+        }
+        if (pipeline) {
+            string params = string(format_names[f]) + "/uint8/NONE/" + size_params(c);
+            run_benchmark("preprocess_specialized", params, (size_t)c.w_out * c.h_out * 3, [&] {
+                pipeline->preprocess(meta, frame.data(), &map, &input);
+                keep(tensor_data.data());
+            });
+        }
+    }
+    mcv_free_resize_map(&map);
+}
+
+//-----------------------------------------------------------------------------
+
+// Detections from a recorded log when one is given, otherwise a fixed
+// synthetic set shaped like a busy SSD frame
+static vector<ai_detection_t> load_detections(size_t count) {
+    vector<ai_detection_t> detections;
+    if (!options.detection_log.empty()) {
+        MappedLogReader log;
+        if (log.Open(options.detection_log, sizeof(ai_detection_t))) {
+            for (uint64_t i = 0; i < log.Count() && detections.size() < count; i++) {
+                detections.push_back(*static_cast<const ai_detection_t *>(log.Record(i)));
+            }
+        }
+        if (!detections.empty()) {
+            while (detections.size() < count) {
+                detections.push_back(detections[detections.size() % log.Count()]);
+            }
+            return detections;
+        }
+        cerr << "Falling back to synthetic detections" << endl;
+    }
+
+    vector<uint8_t> noise = random_bytes(count * 4, 3);
+    for (size_t i = 0; i < count; i++) {
+        ai_detection_t detection = {};
+        detection.magic_number = AI_DETECTION_MAGIC_NUMBER;
+        detection.timestamp_ns = 1000000LL * i;
+        detection.class_id = noise[4 * i] % 90;
+        detection.frame_id = i % 10 == 9 ? -1 : (int)(i / 10);
+        snprintf(detection.class_name, BUF_LEN, "class_%u", detection.class_id);
+        snprintf(detection.cam, BUF_LEN, "onboardcompute");
+        detection.class_confidence = noise[4 * i + 1] / 255.0f;
+        detection.detection_confidence = noise[4 * i + 2] / 255.0f;
+        detection.x_min = noise[4 * i + 3];
+        detection.y_min = noise[4 * i + 3] / 2;
+        detection.x_max = detection.x_min + 40;
+        detection.y_max = detection.y_min + 30;
+        detections.push_back(detection);
+    }
+    return detections;
+}
+
+//-----------------------------------------------------------------------------
+
+static void bench_decode() {
+    vector<int> dims_storage = {4, 1, SsdMobilenetV2::kHeight, SsdMobilenetV2::kWidth, 3};
+    TfLiteTensor input = {};
+    input.type = kTfLiteUInt8;
+    input.dims = reinterpret_cast<TfLiteIntArray *>(dims_storage.data());
+    SsdOutputs outputs;
+    unique_ptr<ModelPipeline> pipeline = create_model_pipeline(
+        "ssdlite_mobilenet_v2_coco.tflite", NONE, &input, outputs.tensors, 4);
+    if (!pipeline) {
+        return;
+    }
+
+    camera_image_metadata_t meta = {};
+    meta.width = SsdMobilenetV2::kWidth;
+    meta.height = SsdMobilenetV2::kHeight;
+    DecodeParams params = {0.5f, nullptr, "onboardcompute"};
+    vector<ai_detection_t> detections(pipeline->max_detections());
+    run_benchmark("decode_specialized", pipeline->name(), outputs.boxes.size() * sizeof(float), [&] {
+        keep(&detections[pipeline->decode(outputs.tensors, meta, params, detections.data()) / 2]);
+    });
+}
+
+//-----------------------------------------------------------------------------
+
+static void bench_detections() {
+    for (size_t count : {10, 100, 1000}) {
+        vector<ai_detection_t> records = load_detections(count);
+        const char* data = reinterpret_cast<const char *>(records.data());
+        int bytes = records.size() * sizeof(ai_detection_t);
+        string params = to_string(count) + "_detections";
+
+        // Same unpacking as tflite_server_cb
+        NameTable names;
+        DetectionBuffer detections;
+        run_benchmark("unpack_detections", params, bytes, [&] {
+            detections.Clear();
+            detections.AppendPacked(data, bytes, names);
+            keep(detections.x_min.data());
+        });
+
+        ComputeRequest request;
+        request.set_min_detection_confidence(0.5f);
+        request.add_class_ids(1);
+        request.add_class_ids(3);
+        request.set_max_results(10);
+        ResultFilter filter;
+        filter.Configure(request);
+        vector<uint32_t> kept;
+        run_benchmark("filter_results", params, bytes, [&] {
+            filter.Apply(detections, kept);
+            keep(kept.data());
+        });
+
+        // SendResult's filter and encoding, without the logging
+        string serialized;
+        run_benchmark("encode_result", params, bytes, [&] {
+            ComputeResult compute_result;
+            filter.Apply(detections, kept);
+            encode_detections(detections, kept, names, compute_result, nullptr);
+            compute_result.SerializeToString(&serialized);
+            keep(serialized.data());
+        });
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+static void bench_dense() {
+    const int w = 513;
+    const int h = 513;
+
+    // Blocky class regions like a deeplab mask, plus a noisy worst case
+    vector<uint8_t> mask((size_t)w * h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            mask[(size_t)y * w + x] = ((x / 64) + (y / 96) * 3) % 7;
+        }
+    }
+    vector<uint8_t> noisy = random_bytes((size_t)w * h, 4);
+    for (uint8_t& v : noisy) {
+        v %= 21;
+    }
+    vector<float> depth((size_t)w * h);
+    for (size_t i = 0; i < depth.size(); i++) {
+        depth[i] = 0.5f + (i % w) * 0.02f + noisy[i] * 0.001f;
+    }
+
+    DenseMap out;
+    for (int downsample : {1, 2, 4}) {
+        string params = to_string(w) + "x" + to_string(h) + "/ds" + to_string(downsample);
+        run_benchmark("encode_mask_blocky", params, mask.size(), [&] {
+            encode_mask(mask.data(), w, h, downsample, out);
+            keep(out.data.data());
+        });
+        run_benchmark("encode_mask_noisy", params, noisy.size(), [&] {
+            encode_mask(noisy.data(), w, h, downsample, out);
+            keep(out.data.data());
+        });
+        for (int bits : {8, 16}) {
+            run_benchmark("encode_depth", params + "/" + to_string(bits) + "bit", depth.size() * sizeof(float), [&] {
+                encode_depth(depth.data(), w, h, downsample, bits, out);
+                keep(out.data.data());
+            });
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+static void print_context() {
+#if defined(__aarch64__)
+    const char* arch = "aarch64";
+#elif defined(__arm__)
+    const char* arch = "arm";
+#elif defined(__x86_64__)
+    const char* arch = "x86_64";
+#else
+    const char* arch = "unknown";
+#endif
+    printf("{\"context\":{\"arch\":\"%s\",\"compiler\":\"%s\",\"min_time_ms\":%d,\"repetitions\":%d}}\n",
+           arch, __VERSION__, options.min_time_ms, options.repetitions);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time-ms" && i + 1 < argc) {
+            options.min_time_ms = max(1, atoi(argv[++i]));
+        } else if (arg == "--repetitions" && i + 1 < argc) {
+            options.repetitions = max(1, atoi(argv[++i]));
+        } else if (arg == "--detection-log" && i + 1 < argc) {
+            options.detection_log = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--filter substring] [--min-time-ms N]"
+                 << " [--repetitions N] [--detection-log path]\n";
+            return -1;
+        }
+    }
+
+    print_context();
+    bench_resize();
+    bench_preprocess();
+    bench_decode();
+    bench_detections();
+    bench_dense();
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
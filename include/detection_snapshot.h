@@ -0,0 +1,209 @@
+#ifndef DETECTION_SNAPSHOT_H
+#define DETECTION_SNAPSHOT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+#include "ai_detection.h"
+
+// Latest detections of every camera, published by steeleagle-os-onboard-compute
+// (--detection-snapshot) into POSIX shared memory for planners, loggers and
+// other processes on the same board. No socket or pipe is involved: locating a
+// camera's newest frame is a single atomic load, so reading costs a memcpy.
+//
+// A snapshot is one client frame as the server answered it: the detections of
+// all its regions of interest, in full frame coordinates, before the client's
+// own result filter.
+//
+// Each camera has a ring of DETECTION_SNAPSHOT_SLOTS frames. The publisher
+// fills the slot after the newest one and then stores its sequence into
+// latest. A reader loads latest, copies that slot and rechecks the slot's
+// sequence. It only has to retry if the publisher lapped the whole ring
+// during the copy.
+//
+// Readers that block in wait() register in waiters, so the publisher only
+// makes the futex wake syscall when somebody is waiting. That needs a
+// writable mapping; a reader that can only map the region read-only polls.
+
+#define DETECTION_SNAPSHOT_SHM_NAME         "/steeleagle-detections"
+#define DETECTION_SNAPSHOT_MAGIC            0x44455453
+#define DETECTION_SNAPSHOT_VERSION          2
+#define DETECTION_SNAPSHOT_MAX_CAMERAS      8
+#define DETECTION_SNAPSHOT_SLOTS            4
+#define DETECTION_SNAPSHOT_MAX_DETECTIONS   64      // per frame, the rest are counted in truncated
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "detection snapshots need address-free atomics to share them between processes");
+
+// one client frame's detections, delimiter records are not stored
+struct DetectionSnapshotSlot {
+    std::atomic<uint64_t> sequence;         // publish number held, 0 while being rewritten
+    int64_t publish_time_ns;                // CLOCK_MONOTONIC
+    uint64_t request_id;                    // counts up with every client frame, across cameras
+    int64_t capture_time_ns;                // the client's CLOCK_REALTIME capture time, 0 if not sent
+    uint32_t num_detections;
+    uint32_t truncated;                     // detections past DETECTION_SNAPSHOT_MAX_DETECTIONS
+    ai_detection_t detections[DETECTION_SNAPSHOT_MAX_DETECTIONS];
+};
+
+struct DetectionSnapshotCamera {
+    char name[BUF_LEN];                     // empty for the default camera
+    std::atomic<uint64_t> latest;           // sequence of the newest complete slot, 0 before the first frame
+    DetectionSnapshotSlot slots[DETECTION_SNAPSHOT_SLOTS];
+};
+
+struct DetectionSnapshotRegion {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> num_cameras;      // cameras[] entries in use, names are set before this grows
+    std::atomic<uint32_t> generation;       // bumped on every publish, futex-woken while waiters > 0
+    std::atomic<uint32_t> waiters;          // readers blocked in wait()
+    DetectionSnapshotCamera cameras[DETECTION_SNAPSHOT_MAX_CAMERAS];
+};
+
+// a reader's private copy of one slot
+struct DetectionSnapshot {
+    uint64_t sequence;
+    int64_t publish_time_ns;
+    uint64_t request_id;
+    int64_t capture_time_ns;
+    uint32_t num_detections;
+    uint32_t truncated;
+    ai_detection_t detections[DETECTION_SNAPSHOT_MAX_DETECTIONS];
+};
+
+static inline long detection_snapshot_futex(const std::atomic<uint32_t>* word, int op, uint32_t value,
+                                            const struct timespec* timeout) {
+    return syscall(SYS_futex, reinterpret_cast<const uint32_t *>(word), op, value, timeout, nullptr, 0);
+}
+
+class DetectionSnapshotReader {
+ public:
+    ~DetectionSnapshotReader() { close(); }
+
+    // maps the region, read-only if this process may not write it. False
+    // while the server isn't publishing.
+    bool open() {
+        close();
+        writable = true;
+        int fd = shm_open(DETECTION_SNAPSHOT_SHM_NAME, O_RDWR, 0);
+        if (fd < 0 && errno == EACCES) {
+            writable = false;
+            fd = shm_open(DETECTION_SNAPSHOT_SHM_NAME, O_RDONLY, 0);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* mapped = mmap(nullptr, sizeof(DetectionSnapshotRegion), prot, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        region = static_cast<DetectionSnapshotRegion *>(mapped);
+        if (region->magic != DETECTION_SNAPSHOT_MAGIC || region->version != DETECTION_SNAPSHOT_VERSION) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (region) {
+            munmap(region, sizeof(DetectionSnapshotRegion));
+            region = nullptr;
+        }
+    }
+
+    // camera index for a name ("" is the default camera), -1 until it has published
+    int find_camera(const std::string& name) const {
+        uint32_t n = region->num_cameras.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < n && i < DETECTION_SNAPSHOT_MAX_CAMERAS; i++) {
+            if (strncmp(region->cameras[i].name, name.c_str(), BUF_LEN) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // one atomic load, compare with an earlier value to see whether anything new arrived
+    uint64_t latest_sequence(int camera) const {
+        return region->cameras[camera].latest.load(std::memory_order_acquire);
+    }
+
+    // copies the newest complete frame, false if the camera hasn't published one
+    bool read_latest(int camera, DetectionSnapshot& out) const {
+        const DetectionSnapshotCamera& cam = region->cameras[camera];
+        while (true) {
+            uint64_t sequence = cam.latest.load(std::memory_order_acquire);
+            if (sequence == 0) {
+                return false;
+            }
+            const DetectionSnapshotSlot& slot = cam.slots[sequence % DETECTION_SNAPSHOT_SLOTS];
+            out.sequence = sequence;
+            out.publish_time_ns = slot.publish_time_ns;
+            out.request_id = slot.request_id;
+            out.capture_time_ns = slot.capture_time_ns;
+            out.truncated = slot.truncated;
+            out.num_detections = slot.num_detections < DETECTION_SNAPSHOT_MAX_DETECTIONS ?
+                                 slot.num_detections : DETECTION_SNAPSHOT_MAX_DETECTIONS;
+            memcpy(out.detections, slot.detections, out.num_detections * sizeof(ai_detection_t));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                return true;
+            }
+        }
+    }
+
+    uint32_t generation() const {
+        return region->generation.load(std::memory_order_acquire);
+    }
+
+    // blocks until any camera publishes after generation was read, false on timeout
+    bool wait(uint32_t generation, int timeout_ms) const {
+        if (!writable) {
+            // Unregistered readers are never woken, check every millisecond instead
+            struct timespec step = {0, 1000000L};
+            for (int waited_ms = 0; region->generation.load(std::memory_order_acquire) == generation;
+                    waited_ms++) {
+                if (waited_ms >= timeout_ms) {
+                    return false;
+                }
+                nanosleep(&step, nullptr);
+            }
+            return true;
+        }
+
+        // Registered before generation is checked, so the publisher either
+        // sees the waiter or the reader sees the new generation
+        struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        bool published = true;
+        region->waiters.fetch_add(1);
+        while (region->generation.load() == generation) {
+            // Returns straight away if a publish slipped in after the load
+            if (detection_snapshot_futex(&region->generation, FUTEX_WAIT, generation, &timeout) < 0 &&
+                    errno == ETIMEDOUT) {
+                published = false;
+                break;
+            }
+        }
+        region->waiters.fetch_sub(1);
+        return published;
+    }
+
+ private:
+    DetectionSnapshotRegion* region = nullptr;
+    bool writable = false;
+};
+
+#endif // DETECTION_SNAPSHOT_H
@@ -0,0 +1,256 @@
+#ifndef INFERENCE_POOL_H
+#define INFERENCE_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define QUEUE_SIZE_PER_WORKER   4           // max frames waiting on one worker, submit() drops once all are full
+
+// group of cores sharing the same max frequency (one big.LITTLE cluster)
+struct CoreCluster {
+    std::vector<int> cpus;                  // logical cpu ids in this cluster
+    long max_freq_khz;                      // 0 if cpufreq is unavailable (x86 VMs, containers)
+};
+
+// one interpreter slot in the pool
+struct InferenceWorkerConfig {
+    std::vector<int> cpus;                  // cores the worker thread (and its tflite threads) is pinned to
+    int num_threads;                        // tflite interpreter thread count for this worker
+    int cluster;                            // index into the cluster list, 0 is the fastest
+};
+
+// reads the cpufreq tables and groups online cpus into clusters, fastest first.
+// falls back to a single cluster of all online cpus when cpufreq is missing.
+static inline std::vector<CoreCluster> discover_core_clusters(void) {
+    std::map<long, std::vector<int>, std::greater<long>> by_freq;
+    int num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+        long freq = 0;
+        FILE* fp = fopen(path, "r");
+        if (fp) {
+            if (fscanf(fp, "%ld", &freq) != 1) freq = 0;
+            fclose(fp);
+        }
+        by_freq[freq].push_back(cpu);
+    }
+
+    std::vector<CoreCluster> clusters;
+    for (auto& entry : by_freq) {
+        clusters.push_back(CoreCluster{entry.second, entry.first});
+    }
+    return clusters;
+}
+
+// splits each cluster into workers of threads_per_worker cores. the fastest
+// cluster gets the first workers so a pool capped by max_workers prefers big
+// cores; the work stealing queue balances whatever speed difference remains.
+static inline std::vector<InferenceWorkerConfig> plan_inference_workers(const std::vector<CoreCluster>& clusters,
+                                                                        int threads_per_worker, int max_workers) {
+    std::vector<InferenceWorkerConfig> workers;
+    if (threads_per_worker < 1) threads_per_worker = 1;
+
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const std::vector<int>& cpus = clusters[c].cpus;
+        size_t n_threads = std::min((size_t)threads_per_worker, cpus.size());
+        for (size_t i = 0; i + n_threads <= cpus.size(); i += n_threads) {
+            if (max_workers > 0 && (int)workers.size() >= max_workers) return workers;
+            InferenceWorkerConfig config;
+            config.cpus.assign(cpus.begin() + i, cpus.begin() + i + n_threads);
+            config.num_threads = (int)n_threads;
+            config.cluster = (int)c;
+            workers.push_back(config);
+        }
+    }
+    return workers;
+}
+
+// pins the calling thread. threads it spawns afterwards (e.g. the tflite
+// cpu backend pool) inherit the mask, so call this before building the interpreter.
+static inline bool pin_current_thread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+}
+
+// Pool of pinned workers, each owning its own interpreter (Worker, normally an
+// InferenceHelper) and fed by a per-worker deque. Idle workers steal from the
+// back of their siblings' deques, so big cores absorb frames LITTLE cores can't
+// keep up with. Worker objects are built on their own thread after pinning.
+//
+// Like inference_helper.h this is shared with voxl-tflite-server, which owns
+// the interpreters; the factory there builds an InferenceHelper per worker and
+// sets its thread count from InferenceWorkerConfig::num_threads.
+template <typename Worker, typename Job>
+class InferencePool
+{
+    public:
+        typedef std::function<std::unique_ptr<Worker>(const InferenceWorkerConfig&)> WorkerFactory;
+        typedef std::function<void(Worker&, Job&)> JobHandler;
+
+        InferencePool(const std::vector<InferenceWorkerConfig>& configs, WorkerFactory factory, JobHandler handler)
+            : configs(configs), factory(factory), handler(handler), queues(configs.size()) {
+            for (size_t i = 0; i < configs.size(); i++) {
+                threads.emplace_back(&InferencePool::worker_loop, this, i);
+            }
+        }
+
+        ~InferencePool() {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                running = false;
+            }
+            wake_cv.notify_all();
+            for (std::thread& t : threads) t.join();
+        }
+
+        InferencePool(const InferencePool&) = delete;
+        InferencePool& operator=(const InferencePool&) = delete;
+
+        // queues a frame on the next live worker round robin, moving on to the
+        // following ones while a queue is full. returns false and drops the
+        // frame only when every live worker has QUEUE_SIZE_PER_WORKER waiting.
+        bool submit(Job&& job) {
+            size_t start = queues.empty() ? 0 : next_queue.fetch_add(1, std::memory_order_relaxed);
+            bool queued = false;
+            for (size_t i = 0; i < queues.size() && !queued; i++) {
+                JobQueue& queue = queues[(start + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.alive && queue.jobs.size() < QUEUE_SIZE_PER_WORKER) {
+                    queue.jobs.push_back(std::move(job));
+                    queued = true;
+                }
+            }
+            if (!queued) {
+                num_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                num_pending++;
+            }
+            wake_cv.notify_one();
+            return true;
+        }
+
+        size_t size() const { return configs.size(); }
+        size_t live_workers() const { return num_live.load(); }
+        uint64_t dropped() const { return num_dropped.load(); }
+        uint64_t stolen() const { return num_stolen.load(); }
+
+    private:
+        struct JobQueue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+            bool alive = true;              // false once the worker failed to start, submit() skips it
+        };
+
+        bool pop_own(size_t idx, Job& job) {
+            std::lock_guard<std::mutex> lock(queues[idx].mutex);
+            if (queues[idx].jobs.empty()) return false;
+            job = std::move(queues[idx].jobs.front());
+            queues[idx].jobs.pop_front();
+            return true;
+        }
+
+        bool steal(size_t thief, Job& job) {
+            for (size_t i = 1; i < queues.size(); i++) {
+                size_t victim = (thief + i) % queues.size();
+                std::lock_guard<std::mutex> lock(queues[victim].mutex);
+                if (queues[victim].jobs.empty()) continue;
+                job = std::move(queues[victim].jobs.back());
+                queues[victim].jobs.pop_back();
+                num_stolen.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        // takes a worker that failed to start out of rotation. frames already
+        // on its queue stay there for siblings to steal; with no live worker
+        // left they are dropped, since nothing would ever run them.
+        void retire(size_t idx) {
+            {
+                std::lock_guard<std::mutex> lock(queues[idx].mutex);
+                queues[idx].alive = false;
+            }
+            if (num_live.fetch_sub(1) != 1) {
+                return;
+            }
+            size_t discarded = 0;
+            for (JobQueue& queue : queues) {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                discarded += queue.jobs.size();
+                queue.jobs.clear();
+            }
+            num_dropped.fetch_add(discarded, std::memory_order_relaxed);
+        }
+
+        void worker_loop(size_t idx) {
+            const InferenceWorkerConfig& config = configs[idx];
+            if (!pin_current_thread(config.cpus)) {
+                fprintf(stderr, "WARNING: failed to pin inference worker %zu\n", idx);
+            }
+
+            std::unique_ptr<Worker> worker = factory(config);
+            if (!worker) {
+                fprintf(stderr, "ERROR: failed to create inference worker %zu\n", idx);
+                retire(idx);
+                return;
+            }
+
+            Job job;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(wake_mutex);
+                    wake_cv.wait(lock, [&] { return num_pending > 0 || !running; });
+                    if (!running) return;
+                    num_pending--;
+                }
+                // the job we claimed can slip past the scan if a sibling took
+                // ours and left theirs behind us, so hand the claim back and rescan
+                if (!pop_own(idx, job) && !steal(idx, job)) {
+                    std::lock_guard<std::mutex> lock(wake_mutex);
+                    num_pending++;
+                    continue;
+                }
+                handler(*worker, job);
+            }
+        }
+
+        std::vector<InferenceWorkerConfig> configs;
+        WorkerFactory factory;
+        JobHandler handler;
+
+        std::vector<JobQueue> queues;
+        std::vector<std::thread> threads;
+        std::atomic<size_t> next_queue{0};
+        std::atomic<size_t> num_live{configs.size()};
+
+        std::mutex wake_mutex;
+        std::condition_variable wake_cv;
+        size_t num_pending = 0;
+        bool running = true;
+
+        std::atomic<uint64_t> num_dropped{0};
+        std::atomic<uint64_t> num_stolen{0};
+};
+
+#endif // INFERENCE_POOL_H
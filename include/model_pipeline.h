@@ -0,0 +1,464 @@
+#ifndef MODEL_PIPELINE_H
+#define MODEL_PIPELINE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "tensorflow/lite/c/common.h"
+
+#include "ai_detection.h"
+#include "tensor_preprocess.h"
+
+// Compile-time specialized preprocess + decode for the models voxl-tflite-server
+// ships. Each model's traits fix its input geometry, element type,
+// normalization and output layout as constants, so SpecializedPipeline<Model>
+// is instantiated with constant trip counts and strides the compiler can
+// unroll and vectorize. create_model_pipeline() picks the specialization once
+// at model load and returns nullptr for anything else, which then keeps using
+// the generic InferenceHelper preprocess_image()/postprocess_*() path.
+//
+// Like inference_helper.h this is shared with voxl-tflite-server, whose
+// inference loop is the runtime caller; nothing in this server runs a model.
+// The bench builds the SSD pipeline through create_model_pipeline() on hand
+// made tensors, so selection, init checks, preprocess and decode are all
+// exercised in this tree.
+//
+// The delegate is bound to the interpreter before the pipeline is created, so
+// nothing here looks at DelegateOpt per frame.
+
+// what the decoder needs from the caller besides the output tensors
+struct DecodeParams {
+    float min_confidence;                   // detections / classes below this are dropped
+    const std::vector<std::string>* labels; // class id -> name, may be null
+    const char* cam;                        // copied into ai_detection_t::cam
+};
+
+static inline void pipeline_fill_detection(ai_detection_t& d, const camera_image_metadata_t& meta,
+                                           const DecodeParams& params, int class_id, float class_confidence,
+                                           float detection_confidence) {
+    memset(&d, 0, sizeof(d));
+    d.magic_number = AI_DETECTION_MAGIC_NUMBER;
+    d.timestamp_ns = meta.timestamp_ns;
+    d.frame_id = meta.frame_id;
+    d.class_id = class_id;
+    d.class_confidence = class_confidence;
+    d.detection_confidence = detection_confidence;
+    if (params.labels && class_id >= 0 && class_id < (int)params.labels->size()) {
+        strncpy(d.class_name, (*params.labels)[class_id].c_str(), BUF_LEN - 1);
+    }
+    if (params.cam) {
+        strncpy(d.cam, params.cam, BUF_LEN - 1);
+    }
+}
+
+// float model output to an int in [0, max], NaN and anything out of range count as invalid
+static inline bool pipeline_output_to_int(float value, int max, int& out) {
+    if (!(value >= 0.0f && value <= (float)max)) {
+        return false;
+    }
+    out = (int)value;
+    return true;
+}
+
+// tensor must be [1, dims...] with exactly these trailing dims
+static inline bool pipeline_check_dims(const TfLiteTensor* tensor, int d1, int d2 = 0) {
+    const TfLiteIntArray* dims = tensor->dims;
+    int expected_size = d2 ? 3 : 2;
+    if (dims->size != expected_size || dims->data[0] != 1 || dims->data[1] != d1 || (d2 && dims->data[2] != d2)) {
+        fprintf(stderr, "ERROR: output tensor %s has an unexpected shape\n", tensor->name ? tensor->name : "");
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// model traits
+
+enum ModelOutputKind { SSD_BOXES, YOLOV5_GRID, CLASS_SCORES };
+
+// ssdlite_mobilenet_v2_coco: TFLite_Detection_PostProcess outputs boxes
+// [1,N,4] (ymin, xmin, ymax, xmax, normalized), classes [1,N], scores [1,N], count [1]
+struct SsdMobilenetV2 {
+    static const char* name() { return "ssd_mobilenet_v2"; }
+    static const char* file_pattern() { return "mobilenet_v2"; }
+    typedef uint8_t InputType;
+    static const int kWidth = 300;
+    static const int kHeight = 300;
+    static const int kChannels = 3;
+    static const NormalizationType kNorm = NONE;
+    static const ModelOutputKind kOutput = SSD_BOXES;
+    static const int kMaxDetections = 10;
+    static const int kMaxClassId = 90;
+    static const int kLabelOffset = 0;
+};
+
+// yolov5s at 320: [1, 3 * (40^2 + 20^2 + 10^2), 5 + classes] rows of
+// (cx, cy, w, h, objectness, class scores...), normalized to the input
+struct Yolov5 {
+    static const char* name() { return "yolov5"; }
+    static const char* file_pattern() { return "yolov5"; }
+    typedef float InputType;
+    static const int kWidth = 320;
+    static const int kHeight = 320;
+    static const int kChannels = 3;
+    static const NormalizationType kNorm = HARD_DIVISION;
+    static const ModelOutputKind kOutput = YOLOV5_GRID;
+    static const int kNumBoxes = 6300;
+    static const int kNumClasses = 80;
+    static const int kMaxDetections = 100;
+    static constexpr float kNmsIou = 0.45f;
+};
+
+// efficientnet-lite0 int8: [1, 1000] quantized class scores
+struct EfficientNetLite0 {
+    static const char* name() { return "efficientnet_lite0"; }
+    static const char* file_pattern() { return "efficientnet_lite0"; }
+    typedef uint8_t InputType;
+    static const int kWidth = 224;
+    static const int kHeight = 224;
+    static const int kChannels = 3;
+    static const NormalizationType kNorm = NONE;
+    static const ModelOutputKind kOutput = CLASS_SCORES;
+    typedef uint8_t OutputType;
+    static const int kNumClasses = 1000;
+    static const int kLabelOffset = 0;
+};
+
+// mobilenet_v1 classification, class 0 is "background"
+struct MobilenetV1Classifier {
+    static const char* name() { return "mobilenet_v1"; }
+    static const char* file_pattern() { return "mobilenet_v1"; }
+    typedef uint8_t InputType;
+    static const int kWidth = 224;
+    static const int kHeight = 224;
+    static const int kChannels = 3;
+    static const NormalizationType kNorm = NONE;
+    static const ModelOutputKind kOutput = CLASS_SCORES;
+    typedef uint8_t OutputType;
+    static const int kNumClasses = 1001;
+    static const int kLabelOffset = 1;
+};
+
+//-----------------------------------------------------------------------------
+// decoders, one per output layout
+
+template <typename Model, ModelOutputKind kind = Model::kOutput>
+class ModelDecoder;
+
+template <typename Model>
+class ModelDecoder<Model, SSD_BOXES>
+{
+    public:
+        static const int kMaxOutputs = Model::kMaxDetections;
+
+        bool init(const TfLiteTensor* const* outputs, int num_outputs) {
+            if (num_outputs < 4 || !pipeline_check_dims(outputs[0], Model::kMaxDetections, 4) ||
+                    !pipeline_check_dims(outputs[1], Model::kMaxDetections) ||
+                    !pipeline_check_dims(outputs[2], Model::kMaxDetections)) {
+                return false;
+            }
+            // the count is a single value, decode() reads only its first element
+            const TfLiteIntArray* count_dims = outputs[3]->dims;
+            if (count_dims->size != 1 || count_dims->data[0] != 1) {
+                fprintf(stderr, "ERROR: output tensor %s has an unexpected shape\n", outputs[3]->name ? outputs[3]->name : "");
+                return false;
+            }
+            for (int i = 0; i < 4; i++) {
+                if (outputs[i]->type != kTfLiteFloat32) {
+                    fprintf(stderr, "ERROR: expected float detection outputs\n");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int decode(const TfLiteTensor* const* outputs, const camera_image_metadata_t& meta,
+                   const DecodeParams& params, ai_detection_t* out) const {
+            const float* boxes = outputs[0]->data.f;
+            const float* classes = outputs[1]->data.f;
+            const float* scores = outputs[2]->data.f;
+            // clamped before the cast, a NaN or huge count from the model counts as none or all
+            float reported = outputs[3]->data.f[0];
+            int count = reported > 0.0f ? (int)std::min(reported, (float)Model::kMaxDetections) : 0;
+
+            int n = 0;
+            for (int i = 0; i < count; i++) {
+                int class_id;
+                if (!(scores[i] >= params.min_confidence) ||
+                        !pipeline_output_to_int(classes[i], Model::kMaxClassId, class_id)) {
+                    continue;
+                }
+                const float* box = boxes + 4 * i;
+                ai_detection_t& d = out[n++];
+                pipeline_fill_detection(d, meta, params, class_id + Model::kLabelOffset, scores[i], scores[i]);
+                d.x_min = box[1] * meta.width;
+                d.y_min = box[0] * meta.height;
+                d.x_max = box[3] * meta.width;
+                d.y_max = box[2] * meta.height;
+            }
+            return n;
+        }
+};
+
+template <typename Model>
+class ModelDecoder<Model, YOLOV5_GRID>
+{
+    public:
+        static const int kMaxOutputs = Model::kMaxDetections;
+
+        bool init(const TfLiteTensor* const* outputs, int num_outputs) {
+            if (num_outputs < 1 || !pipeline_check_dims(outputs[0], Model::kNumBoxes, kStride)) {
+                return false;
+            }
+            if (outputs[0]->type != kTfLiteFloat32) {
+                fprintf(stderr, "ERROR: expected a float yolov5 output\n");
+                return false;
+            }
+            candidates.reserve(Model::kNumBoxes);
+            return true;
+        }
+
+        int decode(const TfLiteTensor* const* outputs, const camera_image_metadata_t& meta,
+                   const DecodeParams& params, ai_detection_t* out) const {
+            const float* rows = outputs[0]->data.f;
+
+            // kStride and kNumClasses are constants, so the class scan unrolls
+            candidates.clear();
+            for (int i = 0; i < Model::kNumBoxes; i++) {
+                const float* row = rows + i * kStride;
+                float objectness = row[4];
+                if (objectness < params.min_confidence) {
+                    continue;
+                }
+                int best = 0;
+                float best_score = row[5];
+                for (int c = 1; c < Model::kNumClasses; c++) {
+                    bool better = row[5 + c] > best_score;
+                    best_score = better ? row[5 + c] : best_score;
+                    best = better ? c : best;
+                }
+                float confidence = objectness * best_score;
+                if (confidence < params.min_confidence) {
+                    continue;
+                }
+                candidates.push_back(Candidate{row[0] - row[2] / 2, row[1] - row[3] / 2,
+                                               row[0] + row[2] / 2, row[1] + row[3] / 2,
+                                               confidence, best_score, best});
+            }
+
+            // greedy per-class NMS, best first
+            std::sort(candidates.begin(), candidates.end(),
+                      [](const Candidate& a, const Candidate& b) { return a.confidence > b.confidence; });
+            int n = 0;
+            for (size_t i = 0; i < candidates.size() && n < Model::kMaxDetections; i++) {
+                const Candidate& c = candidates[i];
+                bool suppressed = false;
+                for (int k = 0; k < n && !suppressed; k++) {
+                    suppressed = kept[k].class_id == c.class_id && iou(kept[k], c) > Model::kNmsIou;
+                }
+                if (suppressed) {
+                    continue;
+                }
+                kept[n] = c;
+                ai_detection_t& d = out[n++];
+                pipeline_fill_detection(d, meta, params, c.class_id, c.class_score, c.confidence);
+                d.x_min = std::max(0.0f, c.x0) * meta.width;
+                d.y_min = std::max(0.0f, c.y0) * meta.height;
+                d.x_max = std::min(1.0f, c.x1) * meta.width;
+                d.y_max = std::min(1.0f, c.y1) * meta.height;
+            }
+            return n;
+        }
+
+    private:
+        static const int kStride = 5 + Model::kNumClasses;
+
+        struct Candidate {
+            float x0, y0, x1, y1;
+            float confidence;
+            float class_score;
+            int class_id;
+        };
+
+        static float iou(const Candidate& a, const Candidate& b) {
+            float w = std::min(a.x1, b.x1) - std::max(a.x0, b.x0);
+            float h = std::min(a.y1, b.y1) - std::max(a.y0, b.y0);
+            if (w <= 0.0f || h <= 0.0f) return 0.0f;
+            float inter = w * h;
+            return inter / ((a.x1 - a.x0) * (a.y1 - a.y0) + (b.x1 - b.x0) * (b.y1 - b.y0) - inter);
+        }
+
+        // sized in init(), decode only reuses them
+        mutable std::vector<Candidate> candidates;
+        mutable Candidate kept[Model::kMaxDetections];
+};
+
+template <typename Model>
+class ModelDecoder<Model, CLASS_SCORES>
+{
+    public:
+        static const int kMaxOutputs = 1;
+
+        bool init(const TfLiteTensor* const* outputs, int num_outputs) {
+            if (num_outputs < 1 || !pipeline_check_dims(outputs[0], Model::kNumClasses)) {
+                return false;
+            }
+            if (outputs[0]->type != tensor_type()) {
+                fprintf(stderr, "ERROR: classification output has type %d, expected %d\n", outputs[0]->type, tensor_type());
+                return false;
+            }
+            return true;
+        }
+
+        // one detection spanning the frame for the top class
+        int decode(const TfLiteTensor* const* outputs, const camera_image_metadata_t& meta,
+                   const DecodeParams& params, ai_detection_t* out) const {
+            const OutputType* scores = static_cast<const OutputType *>(outputs[0]->data.data);
+            int best = Model::kLabelOffset;
+            OutputType best_score = scores[best];
+            for (int c = Model::kLabelOffset + 1; c < Model::kNumClasses; c++) {
+                bool better = scores[c] > best_score;
+                best_score = better ? scores[c] : best_score;
+                best = better ? c : best;
+            }
+
+            // quantization is monotonic, so only the winner is dequantized
+            float confidence = (float)best_score;
+            if (tensor_type() != kTfLiteFloat32) {
+                confidence = (confidence - outputs[0]->params.zero_point) * outputs[0]->params.scale;
+            }
+            if (confidence < params.min_confidence) {
+                return 0;
+            }
+            pipeline_fill_detection(out[0], meta, params, best - Model::kLabelOffset, confidence, confidence);
+            out[0].x_max = meta.width;
+            out[0].y_max = meta.height;
+            return 1;
+        }
+
+    private:
+        typedef typename Model::OutputType OutputType;
+
+        static TfLiteType tensor_type() {
+            return std::is_same<OutputType, float>::value ? kTfLiteFloat32 :
+                   std::is_same<OutputType, int8_t>::value ? kTfLiteInt8 : kTfLiteUInt8;
+        }
+};
+
+//-----------------------------------------------------------------------------
+// runtime interface + registry
+
+class ModelPipeline
+{
+    public:
+        virtual ~ModelPipeline() {}
+        virtual const char* name() const = 0;
+        virtual int max_detections() const = 0;
+
+        // checks the interpreter's tensors against the compiled-in layout and builds the lookup tables
+        virtual bool init(const TfLiteTensor* input, const TfLiteTensor* const* outputs, int num_outputs) = 0;
+
+        // fills the input tensor from a camera frame, map as for TensorPreprocessor
+        virtual bool preprocess(const camera_image_metadata_t& meta, const uint8_t* frame,
+                                const undistort_map_t* map, TfLiteTensor* input) const = 0;
+
+        // writes at most max_detections() records to out, returns how many
+        virtual int decode(const TfLiteTensor* const* outputs, const camera_image_metadata_t& meta,
+                           const DecodeParams& params, ai_detection_t* out) const = 0;
+};
+
+// one per interpreter, decode() reuses scratch space
+template <typename Model>
+class SpecializedPipeline : public ModelPipeline
+{
+    public:
+        const char* name() const override { return Model::name(); }
+        int max_detections() const override { return Decoder::kMaxOutputs; }
+
+        bool init(const TfLiteTensor* input, const TfLiteTensor* const* outputs, int num_outputs) override {
+            if (input->type != tensor_type()) {
+                fprintf(stderr, "ERROR: %s expects input type %d, model has %d\n", Model::name(), tensor_type(), input->type);
+                return false;
+            }
+            return preprocessor.init(input, Model::kNorm) && decoder.init(outputs, num_outputs);
+        }
+
+        bool preprocess(const camera_image_metadata_t& meta, const uint8_t* frame,
+                        const undistort_map_t* map, TfLiteTensor* input) const override {
+            return preprocessor.run(meta, frame, map, static_cast<InputType *>(input->data.data));
+        }
+
+        int decode(const TfLiteTensor* const* outputs, const camera_image_metadata_t& meta,
+                   const DecodeParams& params, ai_detection_t* out) const override {
+            return decoder.decode(outputs, meta, params, out);
+        }
+
+    private:
+        typedef typename Model::InputType InputType;
+        typedef ModelDecoder<Model> Decoder;
+
+        static TfLiteType tensor_type() {
+            return std::is_same<InputType, float>::value ? kTfLiteFloat32 :
+                   std::is_same<InputType, int8_t>::value ? kTfLiteInt8 : kTfLiteUInt8;
+        }
+
+        TensorPreprocessor<InputType, Model::kWidth, Model::kHeight, Model::kChannels> preprocessor;
+        Decoder decoder;
+};
+
+struct ModelPipelineEntry {
+    const char* name;
+    const char* file_pattern;               // substring of the model file name
+    NormalizationType norm;                 // the configured normalization must agree
+    std::unique_ptr<ModelPipeline> (*create)();
+};
+
+template <typename Model>
+static std::unique_ptr<ModelPipeline> create_specialized_pipeline() {
+    return std::unique_ptr<ModelPipeline>(new SpecializedPipeline<Model>());
+}
+
+template <typename Model>
+static ModelPipelineEntry model_pipeline_entry() {
+    return ModelPipelineEntry{Model::name(), Model::file_pattern(), Model::kNorm, &create_specialized_pipeline<Model>};
+}
+
+static inline const std::vector<ModelPipelineEntry>& model_pipeline_registry() {
+    static const std::vector<ModelPipelineEntry> registry = {
+        model_pipeline_entry<SsdMobilenetV2>(),
+        model_pipeline_entry<Yolov5>(),
+        model_pipeline_entry<EfficientNetLite0>(),
+        model_pipeline_entry<MobilenetV1Classifier>(),
+    };
+    return registry;
+}
+
+// called once per model load. returns nullptr (and the caller keeps the
+// generic path) when no specialization matches the file name, the configured
+// normalization, or the interpreter's actual tensors.
+static inline std::unique_ptr<ModelPipeline> create_model_pipeline(const char* model_file, NormalizationType norm,
+                                                                   const TfLiteTensor* input,
+                                                                   const TfLiteTensor* const* outputs, int num_outputs) {
+    for (const ModelPipelineEntry& entry : model_pipeline_registry()) {
+        if (!strstr(model_file, entry.file_pattern) || entry.norm != norm) {
+            continue;
+        }
+        std::unique_ptr<ModelPipeline> pipeline = entry.create();
+        if (pipeline->init(input, outputs, num_outputs)) {
+            fprintf(stderr, "Using the specialized %s pipeline\n", entry.name);
+            return pipeline;
+        }
+        fprintf(stderr, "WARNING: %s does not match the %s pipeline, using the generic path\n", model_file, entry.name);
+    }
+    return nullptr;
+}
+
+#endif // MODEL_PIPELINE_H
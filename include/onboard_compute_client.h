@@ -0,0 +1,140 @@
+#ifndef ONBOARD_COMPUTE_CLIENT_H
+#define ONBOARD_COMPUTE_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "onboard_compute.pb.h"
+
+#define CLIENT_LATENCY_WINDOW   1024        // most recent round trips kept for percentiles
+
+// round trip times from submit() to the result being ready, in ms
+struct ClientLatencyStats {
+    uint64_t completed;                     // results received since connect
+    uint64_t failed;                        // futures resolved with an exception
+    double mean_ms;                         // over the latency window
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+// Asynchronous client for steeleagle-os-onboard-compute's REP socket.
+//
+// Requests are pipelined over a DEALER socket: up to max_in_flight are on the
+// wire at once and one I/O thread resolves the futures. submit() blocks while
+// max_in_flight requests are outstanding. The REP frontend still handles one
+// request at a time, so pipelining only overlaps sending the next frames with
+// the current one's inference; it does not make the server process frames in
+// parallel. That takes the Gabriel frontend (--gabriel-tokens), which speaks
+// a different protocol.
+//
+// A request not answered within timeout_ms frees its slot, and its future
+// fails with a runtime_error. Each request carries an id that the REP socket
+// echoes back in its envelope, so a late reply is dropped instead of being
+// matched to a newer request. timeout_ms <= 0 waits forever.
+//
+// Without tile deltas, frames are sent zero-copy as a message part after the
+// serialized request, straight from the caller's buffer. It must stay untouched
+// until the returned future is ready. A timed out request's future is only
+// failed once zmq no longer reads its frame, which can be later than the
+// deadline while the server is unreachable.
+//
+// With enable_tile_delta() only the tiles that changed since the previous
+// frame are sent. These, and keyframes, are copied into the client's own
+// buffers, so the caller's buffer is free again once submit() returns.
+class OnboardComputeClient {
+ public:
+    OnboardComputeClient(const std::string& address, int max_in_flight = 4, int timeout_ms = 5000);
+    ~OnboardComputeClient();
+
+    // frame is a YUV422 image of width * height * 2 bytes
+    std::future<steeleagle::ComputeResult> submit(const uint8_t* frame, int width, int height);
+    // request supplies regions of interest, filters and deadlines. Its
+    // frame_data, frame_width and frame_height are ignored.
+    std::future<steeleagle::ComputeResult> submit(const steeleagle::ComputeRequest& request,
+                                                  const uint8_t* frame, int width, int height);
+
+    // Sends a keyframe every keyframe_interval frames, when more than half the
+    // tiles changed, or after the server lost its reference. tile_width must be even.
+    void enable_tile_delta(int tile_width, int tile_height, int keyframe_interval);
+
+    int in_flight();
+    ClientLatencyStats latency_stats();
+
+ private:
+    struct Submission {
+        uint64_t id;                        // sent ahead of the envelope delimiter, echoed in the reply
+        std::string header;                 // serialized ComputeRequest without the frame
+        const uint8_t* frame;
+        size_t frame_bytes;
+        bool owns_frame;                    // owned_frame is sent instead of frame, even when empty
+        std::string owned_frame;            // changed tiles of a tile delta, or a copy of a keyframe
+        int64_t submit_time_ns;
+        int64_t deadline_ns;
+        std::shared_ptr<std::atomic<bool>> frame_released;  // set by zmq, null until frame is sent
+        std::promise<steeleagle::ComputeResult> result;
+    };
+
+    void io_loop();
+    void send_queued();
+    void receive_results();
+    // Frees the slots of requests past their deadline, fails their futures
+    // once zmq is done with their frames
+    void expire_requests();
+    int poll_timeout_ms();
+    void record_latency(int64_t latency_ns, bool ok);
+    // Fills delta and tiles with the changed tiles, or returns false with a
+    // copy of the whole frame in tiles for a keyframe
+    bool encode_tile_delta(const uint8_t* frame, int width, int height, steeleagle::TileDelta& delta,
+                           std::string& tiles);
+
+    zmq::context_t context;
+    zmq::socket_t socket;
+    int wake_fd;                            // eventfd, signalled by submit()
+    int max_in_flight;
+    int64_t timeout_ns;                     // INT64_MAX when requests never time out
+
+    std::mutex mtx;
+    std::condition_variable slot_cv;
+    std::deque<Submission> queued;          // submitted, not yet sent (I/O thread sends)
+    std::deque<Submission> sent;            // on the wire, deadlines in submit order
+    std::deque<Submission> expired;         // timed out, zmq still reads their frames
+    int outstanding = 0;                    // queued + sent
+    uint64_t next_id = 0;
+
+    std::mutex stats_mtx;
+    std::vector<int64_t> latencies_ns;      // ring of the last CLIENT_LATENCY_WINDOW round trips
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+
+    // Tile delta state, only used under submit_mtx
+    std::mutex submit_mtx;
+    std::string client_id;
+    int tile_width = 0;                     // 0 while deltas are disabled
+    int tile_height = 0;
+    int keyframe_interval = 0;
+    int frames_since_keyframe = 0;
+    uint32_t sequence = 0;
+    std::vector<uint8_t> reference;         // what the server's reference frame holds
+    int reference_width = 0;
+    int reference_height = 0;
+    std::atomic<bool> force_keyframe{false};
+
+    std::atomic<bool> running{true};
+    std::thread io_thread;
+};
+
+#endif // ONBOARD_COMPUTE_CLIENT_H
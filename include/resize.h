@@ -24,12 +24,17 @@ typedef struct undistort_map_t{
 } undistort_map_t;
 
 // takes the input and output dimensions and generates a lookup table
+// every 2x2 square stays inside the input and the 4 coefficients sum to 255
 int mcv_init_resize_map(int w_in, int h_in, int w_out, int h_out, undistort_map_t* map);
+// frees the lookup table allocated by mcv_init_resize_map
+void mcv_free_resize_map(undistort_map_t* map);
 
 // resizes the image using the lookup table created by mcv_init_resize_map
 int mcv_resize_image(const uint8_t* input, uint8_t* output, undistort_map_t* map);
 // "" but with 3 channels
 int mcv_resize_8uc3_image(const uint8_t* rgb_input, uint8_t* output, undistort_map_t* map);
+// "" but packed YUYV, bilinear on luma and nearest on chroma. w_out must be even
+int mcv_resize_yuv422_image(const uint8_t* yuyv_input, uint8_t* output, undistort_map_t* map);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,249 @@
+#ifndef TENSOR_PREPROCESS_H
+#define TENSOR_PREPROCESS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <modal_pipe.h>
+
+#include "tensorflow/lite/c/common.h"
+
+#include "inference_helper.h"
+#include "resize.h"
+
+// Fused resize + color conversion + normalization + quantization straight into
+// the input tensor. Replaces preprocess_image()/run_inference()'s Mat copies:
+// each output element is one bilinear tap on the camera frame followed by a
+// 256 entry table lookup, so no float pass is made for uint8/int8 models.
+//
+// The resize map must come from mcv_init_resize_map(), which keeps every
+// lookup's 2x2 square inside the input image.
+
+// BT.601 full range, same coefficients as cv::COLOR_YUV2RGB
+static inline void tensor_yuv_to_rgb(int y, int u, int v, int rgb[3]) {
+    int d = u - 128;
+    int e = v - 128;
+    int r = y + ((91881 * e) >> 16);
+    int g = y - ((22554 * d + 46802 * e) >> 16);
+    int b = y + ((116130 * d) >> 16);
+    rgb[0] = r < 0 ? 0 : (r > 255 ? 255 : r);
+    rgb[1] = g < 0 ? 0 : (g > 255 ? 255 : g);
+    rgb[2] = b < 0 ? 0 : (b > 255 ? 255 : b);
+}
+
+// one bilinear tap, step is the distance in bytes between horizontal neighbours
+static inline int tensor_bilinear_tap(const uint8_t* plane, int stride, int step, const bilinear_lookup_t& L) {
+    const uint8_t* p = plane + L.I[1] * stride + L.I[0] * step;
+    int acc = L.F[0] * p[0] + L.F[1] * p[step] + L.F[2] * p[stride] + L.F[3] * p[stride + step];
+    return (acc + 127) / 255;
+}
+
+// kWidth, kHeight and kChannels fix the tensor geometry at compile time when
+// non-zero, so the pixel loops get a constant trip count and the channel
+// branches fold away. Zero reads them from the tensor in init().
+template <typename T, int kWidth = 0, int kHeight = 0, int kChannels = 0>
+class TensorPreprocessor
+{
+    public:
+        // builds the per-channel lookup tables. With NONE an integer tensor's
+        // quantization already describes the pixel encoding, so uint8 takes
+        // pixels as they are and int8 shifts them by 128. A configured
+        // normalization is folded through the tensor's scale and zero point.
+        bool init(const TfLiteTensor* input, NormalizationType norm) {
+            if (input->dims->size != 4) {
+                fprintf(stderr, "ERROR: expected NHWC input tensor, got %d dims\n", input->dims->size);
+                return false;
+            }
+            height = input->dims->data[1];
+            width = input->dims->data[2];
+            channels = input->dims->data[3];
+            if ((kWidth && width != kWidth) || (kHeight && height != kHeight) || (kChannels && channels != kChannels)) {
+                fprintf(stderr, "ERROR: input tensor is %dx%dx%d, preprocessor was built for %dx%dx%d\n",
+                        width, height, channels, kWidth, kHeight, kChannels);
+                return false;
+            }
+            if (channels != 1 && channels != 3) {
+                fprintf(stderr, "ERROR: unsupported input channel count %d\n", channels);
+                return false;
+            }
+
+            for (int c = 0; c < 3; c++) {
+                for (int v = 0; v < 256; v++) {
+                    lut[c][v] = quantize(v, norm, input);
+                }
+            }
+
+            // raw pixels must pass through untouched, as the generic path copies them
+            if (norm == NONE && input->type != kTfLiteFloat32) {
+                int shift = input->type == kTfLiteInt8 ? 128 : 0;
+                for (int v = 0; v < 256; v++) {
+                    if (lut[0][v] != v - shift || lut[1][v] != v - shift || lut[2][v] != v - shift) {
+                        fprintf(stderr, "ERROR: unnormalized lookup table maps %d to %d\n", v, (int)lut[0][v]);
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // resizes, converts and quantizes one frame into tensor memory
+        bool run(const camera_image_metadata_t& meta, const uint8_t* frame, const undistort_map_t* map, T* tensor) const {
+            if (map->w_in != meta.width || map->h_in != meta.height || map->w_out != model_width() || map->h_out != model_height()) {
+                fprintf(stderr, "ERROR: resize map does not match %dx%d -> %dx%d\n", meta.width, meta.height, width, height);
+                return false;
+            }
+
+            const int w = meta.width;
+            const int h = meta.height;
+            const int n = model_width() * model_height();
+            const bilinear_lookup_t* L = map->L;
+
+            switch (meta.format) {
+                case IMAGE_FORMAT_RAW8:
+                    for (int i = 0; i < n; i++) {
+                        int y = tensor_bilinear_tap(frame, w, 1, L[i]);
+                        store_gray(tensor, i, y);
+                    }
+                    return true;
+
+                case IMAGE_FORMAT_NV12:
+                case IMAGE_FORMAT_NV21: {
+                    const uint8_t* uv = frame + w * h;
+                    const int u_off = meta.format == IMAGE_FORMAT_NV12 ? 0 : 1;
+                    for (int i = 0; i < n; i++) {
+                        int y = tensor_bilinear_tap(frame, w, 1, L[i]);
+                        if (model_channels() == 1) {
+                            store_gray(tensor, i, y);
+                            continue;
+                        }
+                        const uint8_t* c = uv + (L[i].I[1] >> 1) * w + (L[i].I[0] & ~1);
+                        store_yuv(tensor, i, y, c[u_off], c[1 - u_off]);
+                    }
+                    return true;
+                }
+
+                case IMAGE_FORMAT_YUV422:
+                    // packed YUYV, luma every 2 bytes, one U/V pair per 4 bytes
+                    for (int i = 0; i < n; i++) {
+                        int y = tensor_bilinear_tap(frame, 2 * w, 2, L[i]);
+                        if (model_channels() == 1) {
+                            store_gray(tensor, i, y);
+                            continue;
+                        }
+                        const uint8_t* c = frame + L[i].I[1] * 2 * w + (L[i].I[0] & ~1) * 2;
+                        store_yuv(tensor, i, y, c[1], c[3]);
+                    }
+                    return true;
+
+                case IMAGE_FORMAT_RGB:
+                    for (int i = 0; i < n; i++) {
+                        int rgb[3];
+                        for (int c = 0; c < 3; c++) {
+                            rgb[c] = tensor_bilinear_tap(frame + c, 3 * w, 3, L[i]);
+                        }
+                        store_rgb(tensor, i, rgb);
+                    }
+                    return true;
+
+                default:
+                    fprintf(stderr, "ERROR: unsupported image format %d for tensor preprocessing\n", meta.format);
+                    return false;
+            }
+        }
+
+        int model_width() const { return kWidth ? kWidth : width; }
+        int model_height() const { return kHeight ? kHeight : height; }
+        int model_channels() const { return kChannels ? kChannels : channels; }
+
+    private:
+        // PIXEL_MEAN maps to [-1, 1], HARD_DIVISION to [0, 1], NONE keeps 0..255
+        static float normalize(float v, NormalizationType norm) {
+            switch (norm) {
+                case PIXEL_MEAN:    return (v - 127.5f) / 127.5f;
+                case HARD_DIVISION: return v / 255.0f;
+                default:            return v;
+            }
+        }
+
+        static T quantize(int pixel, NormalizationType norm, const TfLiteTensor* input) {
+            float v = normalize((float)pixel, norm);
+            if (input->type == kTfLiteFloat32) return (T)v;
+
+            // raw pixels, int8 recentred on 0
+            if (norm == NONE) {
+                return (T)(input->type == kTfLiteInt8 ? pixel - 128 : pixel);
+            }
+
+            float scale = input->params.scale != 0.0f ? input->params.scale : 1.0f;
+            long q = lroundf(v / scale) + input->params.zero_point;
+            long lo = input->type == kTfLiteInt8 ? -128 : 0;
+            long hi = input->type == kTfLiteInt8 ? 127 : 255;
+            return (T)(q < lo ? lo : (q > hi ? hi : q));
+        }
+
+        void store_gray(T* tensor, int i, int y) const {
+            if (model_channels() == 1) {
+                tensor[i] = lut[0][y];
+                return;
+            }
+            T* px = tensor + 3 * i;
+            px[0] = lut[0][y];
+            px[1] = lut[1][y];
+            px[2] = lut[2][y];
+        }
+
+        void store_yuv(T* tensor, int i, int y, int u, int v) const {
+            int rgb[3];
+            tensor_yuv_to_rgb(y, u, v, rgb);
+            store_rgb(tensor, i, rgb);
+        }
+
+        void store_rgb(T* tensor, int i, const int rgb[3]) const {
+            if (model_channels() == 1) {
+                // BT.601 luma
+                tensor[i] = lut[0][(19595 * rgb[0] + 38470 * rgb[1] + 7471 * rgb[2] + 32768) >> 16];
+                return;
+            }
+            T* px = tensor + 3 * i;
+            px[0] = lut[0][rgb[0]];
+            px[1] = lut[1][rgb[1]];
+            px[2] = lut[2][rgb[2]];
+        }
+
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        T lut[3][256];
+};
+
+// picks the element type from the tensor and writes into its buffer. init()
+// is cheap (768 table entries) but should still only run once per model load.
+struct InputTensorPreprocessor {
+    TfLiteType type = kTfLiteNoType;
+    TensorPreprocessor<uint8_t> u8;
+    TensorPreprocessor<int8_t> i8;
+    TensorPreprocessor<float> f32;
+
+    bool init(const TfLiteTensor* input, NormalizationType norm) {
+        type = input->type;
+        switch (type) {
+            case kTfLiteUInt8:   return u8.init(input, norm);
+            case kTfLiteInt8:    return i8.init(input, norm);
+            case kTfLiteFloat32: return f32.init(input, norm);
+            default:
+                fprintf(stderr, "ERROR: unsupported input tensor type %d\n", type);
+                return false;
+        }
+    }
+
+    bool run(const camera_image_metadata_t& meta, const uint8_t* frame, const undistort_map_t* map, TfLiteTensor* input) const {
+        switch (type) {
+            case kTfLiteUInt8:   return u8.run(meta, frame, map, input->data.uint8);
+            case kTfLiteInt8:    return i8.run(meta, frame, map, input->data.int8);
+            case kTfLiteFloat32: return f32.run(meta, frame, map, input->data.f);
+            default:             return false;
+        }
+    }
+};
+
+#endif // TENSOR_PREPROCESS_H
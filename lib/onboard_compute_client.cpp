@@ -0,0 +1,420 @@
+#include "onboard_compute_client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+using namespace std;
+using namespace steeleagle;
+
+//-----------------------------------------------------------------------------
+
+static int64_t client_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+
+// The caller owns the frame, zmq only borrows it until the send completes.
+// hint is a heap copy of the submission's frame_released.
+static void borrowed_frame_free(void *data, void *hint) {
+    shared_ptr<atomic<bool>>* released = static_cast<shared_ptr<atomic<bool>> *>(hint);
+    **released = true;
+    delete released;
+}
+
+//-----------------------------------------------------------------------------
+
+OnboardComputeClient::OnboardComputeClient(const string& address, int max_in_flight, int timeout_ms) :
+    context(1),
+    socket(context, ZMQ_DEALER),
+    wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    max_in_flight(max(1, max_in_flight)),
+    timeout_ns(timeout_ms > 0 ? timeout_ms * 1000000LL : INT64_MAX) {
+
+    socket.setsockopt(ZMQ_LINGER, 0);
+    socket.connect(address);
+    latencies_ns.reserve(CLIENT_LATENCY_WINDOW);
+    io_thread = thread(&OnboardComputeClient::io_loop, this);
+}
+
+//-----------------------------------------------------------------------------
+
+OnboardComputeClient::~OnboardComputeClient() {
+    running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        cerr << "Could not wake client I/O thread: " << strerror(errno) << endl;
+    }
+    io_thread.join();
+
+    lock_guard<mutex> lock(mtx);
+    for (deque<Submission>* submissions : {&sent, &queued, &expired}) {
+        for (Submission& submission : *submissions) {
+            submission.result.set_exception(make_exception_ptr(runtime_error("client closed")));
+        }
+        submissions->clear();
+    }
+    slot_cv.notify_all();
+    close(wake_fd);
+}
+
+//-----------------------------------------------------------------------------
+
+future<ComputeResult> OnboardComputeClient::submit(const uint8_t* frame, int width, int height) {
+    return submit(ComputeRequest(), frame, width, height);
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::enable_tile_delta(int tile_width, int tile_height, int keyframe_interval) {
+    lock_guard<mutex> lock(submit_mtx);
+    this->tile_width = max(2, tile_width & ~1);
+    this->tile_height = max(1, tile_height);
+    this->keyframe_interval = max(1, keyframe_interval);
+    client_id = to_string(random_device()());
+    reference.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+future<ComputeResult> OnboardComputeClient::submit(const ComputeRequest& request,
+                                                   const uint8_t* frame, int width, int height) {
+    // Deltas chain onto the previous frame, so they are built and queued in order
+    lock_guard<mutex> submit_lock(submit_mtx);
+
+    Submission submission;
+    ComputeRequest header(request);
+    header.clear_frame_data();
+    header.set_frame_width(width);
+    header.set_frame_height(height);
+    submission.frame = frame;
+    submission.frame_bytes = (size_t)width * height * 2;
+    submission.owns_frame = tile_width > 0;
+    if (tile_width > 0) {
+        header.set_client_id(client_id);
+        header.set_frame_sequence(++sequence);
+        if (encode_tile_delta(frame, width, height, *header.mutable_delta(), submission.owned_frame)) {
+            header.mutable_delta()->set_reference_sequence(sequence - 1);
+        } else {
+            header.clear_delta();
+        }
+    }
+    header.SerializeToString(&submission.header);
+    future<ComputeResult> result = submission.result.get_future();
+
+    {
+        unique_lock<mutex> lock(mtx);
+        slot_cv.wait(lock, [&] { return outstanding < max_in_flight || !running; });
+        if (!running) {
+            submission.result.set_exception(make_exception_ptr(runtime_error("client closed")));
+            return result;
+        }
+        submission.id = ++next_id;
+        submission.submit_time_ns = client_time_ns();
+        submission.deadline_ns = timeout_ns == INT64_MAX ? INT64_MAX : submission.submit_time_ns + timeout_ns;
+        queued.push_back(move(submission));
+        outstanding++;
+    }
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        cerr << "Could not wake client I/O thread: " << strerror(errno) << endl;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+
+bool OnboardComputeClient::encode_tile_delta(const uint8_t* frame, int width, int height, TileDelta& delta,
+                                             string& tiles) {
+    size_t frame_bytes = (size_t)width * height * 2;
+    bool keyframe = force_keyframe.exchange(false) || reference_width != width || reference_height != height ||
+                    reference.size() != frame_bytes || ++frames_since_keyframe >= keyframe_interval;
+    if (keyframe) {
+        // Sent from a copy too, the reference must match what the server receives
+        tiles.assign(reinterpret_cast<const char *>(frame), frame_bytes);
+        reference.assign(frame, frame + frame_bytes);
+        reference_width = width;
+        reference_height = height;
+        frames_since_keyframe = 0;
+        return false;
+    }
+
+    int cols = (width + tile_width - 1) / tile_width;
+    int rows = (height + tile_height - 1) / tile_height;
+    string changed_tiles(((size_t)cols * rows + 7) / 8, 0);
+    size_t row_bytes = (size_t)width * 2;
+    int num_changed = 0;
+    tiles.clear();
+
+    for (int ty = 0; ty < rows; ty++) {
+        int th = min(tile_height, height - ty * tile_height);
+        for (int tx = 0; tx < cols; tx++) {
+            size_t tile_row_bytes = (size_t)min(tile_width, width - tx * tile_width) * 2;
+            size_t offset = (size_t)ty * tile_height * row_bytes + (size_t)tx * tile_width * 2;
+            int r = 0;
+            while (r < th && memcmp(frame + offset + r * row_bytes, &reference[offset + r * row_bytes],
+                                    tile_row_bytes) == 0) {
+                r++;
+            }
+            if (r == th) {
+                continue;
+            }
+
+            size_t t = (size_t)ty * cols + tx;
+            changed_tiles[t >> 3] |= 1 << (t & 7);
+            num_changed++;
+            for (r = 0; r < th; r++) {
+                const uint8_t* src = frame + offset + r * row_bytes;
+                tiles.append(reinterpret_cast<const char *>(src), tile_row_bytes);
+                memcpy(&reference[offset + r * row_bytes], src, tile_row_bytes);
+            }
+        }
+    }
+
+    // Mostly changed frames are cheaper as keyframes
+    if (2 * num_changed > cols * rows) {
+        tiles.assign(reinterpret_cast<const char *>(frame), frame_bytes);
+        reference.assign(frame, frame + frame_bytes);
+        frames_since_keyframe = 0;
+        return false;
+    }
+
+    delta.set_tile_width(tile_width);
+    delta.set_tile_height(tile_height);
+    delta.set_changed_tiles(changed_tiles);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+int OnboardComputeClient::in_flight() {
+    lock_guard<mutex> lock(mtx);
+    return outstanding;
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::io_loop() {
+    zmq::pollitem_t poll_items[2];
+    poll_items[0].socket = (void *)socket;
+    poll_items[0].fd = 0;
+    poll_items[0].events = ZMQ_POLLIN;
+    poll_items[1].socket = nullptr;
+    poll_items[1].fd = wake_fd;
+    poll_items[1].events = ZMQ_POLLIN;
+
+    while (running) {
+        zmq::poll(poll_items, 2, poll_timeout_ms());
+
+        if (poll_items[1].revents & ZMQ_POLLIN) {
+            uint64_t wakeups;
+            if (read(wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+                cerr << "Could not read client wakeups" << endl;
+            }
+            send_queued();
+        }
+        if (poll_items[0].revents & ZMQ_POLLIN) {
+            receive_results();
+        }
+        expire_requests();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+int OnboardComputeClient::poll_timeout_ms() {
+    lock_guard<mutex> lock(mtx);
+    // zmq doesn't signal when it lets go of a frame, so expired requests are polled
+    if (!expired.empty()) {
+        return 10;
+    }
+    int64_t next_deadline_ns = INT64_MAX;
+    for (deque<Submission>* submissions : {&sent, &queued}) {
+        if (!submissions->empty()) {
+            next_deadline_ns = min(next_deadline_ns, submissions->front().deadline_ns);
+        }
+    }
+    if (next_deadline_ns == INT64_MAX) {
+        return 1000;
+    }
+    int64_t wait_ms = (next_deadline_ns - client_time_ns() + 999999) / 1000000;
+    return (int)max((int64_t)0, min(wait_ms, (int64_t)1000));
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::expire_requests() {
+    vector<Submission> timed_out;
+    bool freed = false;
+    {
+        lock_guard<mutex> lock(mtx);
+        // Deadlines grow in submit order, so only the front of each queue can be due
+        int64_t now_ns = client_time_ns();
+        for (deque<Submission>* submissions : {&sent, &queued}) {
+            while (!submissions->empty() && submissions->front().deadline_ns <= now_ns) {
+                expired.push_back(move(submissions->front()));
+                submissions->pop_front();
+                outstanding--;
+                freed = true;
+            }
+        }
+        for (auto it = expired.begin(); it != expired.end();) {
+            if (!it->frame_released || *it->frame_released) {
+                timed_out.push_back(move(*it));
+                it = expired.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (freed) {
+        slot_cv.notify_all();
+    }
+
+    for (Submission& submission : timed_out) {
+        record_latency(client_time_ns() - submission.submit_time_ns, false);
+        submission.result.set_exception(make_exception_ptr(runtime_error("request timed out")));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::send_queued() {
+    unique_lock<mutex> lock(mtx);
+    while (!queued.empty()) {
+        sent.push_back(move(queued.front()));
+        queued.pop_front();
+        Submission& submission = sent.back();
+        lock.unlock();
+
+        // [request id][empty delimiter][request][frame]. The REP socket keeps
+        // everything up to the delimiter as the envelope it replies with.
+        zmq::message_t id(&submission.id, sizeof(submission.id));
+        zmq::message_t delimiter;
+        zmq::message_t header(submission.header.data(), submission.header.size());
+        zmq::message_t frame;
+        if (submission.owns_frame) {
+            // An unchanged frame is a delta with no tiles, the part goes out empty
+            frame = zmq::message_t(submission.owned_frame.data(), submission.owned_frame.size());
+        } else {
+            submission.frame_released = make_shared<atomic<bool>>(false);
+            frame = zmq::message_t(const_cast<uint8_t *>(submission.frame), submission.frame_bytes,
+                                   borrowed_frame_free, new shared_ptr<atomic<bool>>(submission.frame_released));
+        }
+        socket.send(id, ZMQ_SNDMORE);
+        socket.send(delimiter, ZMQ_SNDMORE);
+        socket.send(header, ZMQ_SNDMORE);
+        socket.send(frame);
+
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::receive_results() {
+    zmq::message_t id_msg;
+    while (socket.recv(&id_msg, ZMQ_DONTWAIT)) {
+        // [request id][empty delimiter][result], the rest of a message is already here
+        zmq::message_t message;
+        int parts = 1;
+        for (bool more = id_msg.more(); more; more = message.more()) {
+            socket.recv(&message);
+            parts++;
+        }
+        if (parts != 3 || id_msg.size() != sizeof(uint64_t)) {
+            cerr << "Unexpected reply from server" << endl;
+            continue;
+        }
+        uint64_t id;
+        memcpy(&id, id_msg.data(), sizeof(id));
+
+        Submission submission;
+        {
+            lock_guard<mutex> lock(mtx);
+            auto it = find_if(sent.begin(), sent.end(), [id](const Submission& s) { return s.id == id; });
+            if (it == sent.end()) {
+                // Answered after its deadline, its future has failed already
+                continue;
+            }
+            submission = move(*it);
+            sent.erase(it);
+            outstanding--;
+        }
+        slot_cv.notify_one();
+
+        ComputeResult result;
+        bool ok = result.ParseFromArray(message.data(), message.size());
+        if (ok && result.status() == ComputeResult::REFERENCE_MISSING) {
+            force_keyframe = true;
+        }
+        record_latency(client_time_ns() - submission.submit_time_ns, ok);
+        if (ok) {
+            submission.result.set_value(move(result));
+        } else {
+            submission.result.set_exception(make_exception_ptr(runtime_error("could not parse ComputeResult")));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OnboardComputeClient::record_latency(int64_t latency_ns, bool ok) {
+    lock_guard<mutex> lock(stats_mtx);
+    if (!ok) {
+        failed++;
+        return;
+    }
+    if (latencies_ns.size() < CLIENT_LATENCY_WINDOW) {
+        latencies_ns.push_back(latency_ns);
+    } else {
+        latencies_ns[completed % CLIENT_LATENCY_WINDOW] = latency_ns;
+    }
+    completed++;
+}
+
+//-----------------------------------------------------------------------------
+
+ClientLatencyStats OnboardComputeClient::latency_stats() {
+    vector<int64_t> window;
+    ClientLatencyStats stats = {};
+    {
+        lock_guard<mutex> lock(stats_mtx);
+        window = latencies_ns;
+        stats.completed = completed;
+        stats.failed = failed;
+    }
+    if (window.empty()) {
+        return stats;
+    }
+
+    sort(window.begin(), window.end());
+    size_t n = window.size();
+    int64_t total_ns = 0;
+    for (int64_t latency_ns : window) {
+        total_ns += latency_ns;
+    }
+    auto percentile_ms = [&](double p) {
+        return window[min(n - 1, (size_t)(p * n))] / 1e6;
+    };
+
+    stats.mean_ms = total_ns / 1e6 / n;
+    stats.p50_ms = percentile_ms(0.50);
+    stats.p90_ms = percentile_ms(0.90);
+    stats.p99_ms = percentile_ms(0.99);
+    stats.max_ms = window.back() / 1e6;
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,305 @@
+#include "dense_encode.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+//-----------------------------------------------------------------------------
+
+// Length of the run of equal bytes starting at p, comparing 8 bytes per step
+static size_t run_length(const uint8_t* p, size_t remaining) {
+    uint64_t repeated = p[0] * 0x0101010101010101ULL;
+    size_t i = 1;
+    while (i + 8 <= remaining) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        if (word != repeated) {
+            break;
+        }
+        i += 8;
+    }
+    while (i < remaining && p[i] == p[0]) {
+        i++;
+    }
+    return i;
+}
+
+//-----------------------------------------------------------------------------
+
+static size_t varint_size(size_t value) {
+    size_t bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        bytes++;
+    }
+    return bytes;
+}
+
+//-----------------------------------------------------------------------------
+
+void encode_mask(const uint8_t* mask, int width, int height, int downsample, DenseMap& out) {
+    static thread_local vector<uint8_t> sampled;
+    static thread_local vector<uint32_t> runs;
+
+    // A step past the map would sample nothing but the first pixel
+    downsample = max(1, min(downsample, min(width, height)));
+    out.width = (width + downsample - 1) / downsample;
+    out.height = (height + downsample - 1) / downsample;
+    size_t n = (size_t)out.width * out.height;
+
+    // Class ids can't be averaged, so masks are point sampled
+    const uint8_t* pixels = mask;
+    if (downsample > 1) {
+        sampled.resize(n);
+        for (int y = 0; y < out.height; y++) {
+            const uint8_t* src = mask + (size_t)y * downsample * width;
+            uint8_t* dst = sampled.data() + (size_t)y * out.width;
+            for (int x = 0; x < out.width; x++) {
+                dst[x] = src[x * downsample];
+            }
+        }
+        pixels = sampled.data();
+    }
+
+    uint8_t present[256] = {};
+    for (size_t i = 0; i < n; i++) {
+        present[pixels[i]] = 1;
+    }
+    uint8_t index_of[256];
+    out.palette.clear();
+    for (int class_id = 0; class_id < 256; class_id++) {
+        index_of[class_id] = out.palette.size();
+        if (present[class_id]) {
+            out.palette.push_back(class_id);
+        }
+    }
+    size_t num_colors = out.palette.size();
+    out.bits_per_index = num_colors <= 2 ? 1 : num_colors <= 4 ? 2 : num_colors <= 16 ? 4 : 8;
+
+    // Size both encodings from the run lengths before writing either
+    runs.clear();
+    size_t rle_bytes = 0;
+    for (size_t i = 0; i < n;) {
+        size_t run = run_length(pixels + i, n - i);
+        runs.push_back(run);
+        rle_bytes += varint_size(run) + 1;
+        i += run;
+    }
+    size_t packed_bytes = (n * out.bits_per_index + 7) / 8;
+
+    out.data.clear();
+    if (rle_bytes < packed_bytes) {
+        out.encoding = DENSE_RLE;
+        out.data.reserve(rle_bytes);
+        size_t i = 0;
+        for (uint32_t run : runs) {
+            uint8_t index = index_of[pixels[i]];
+            i += run;
+            while (run >= 0x80) {
+                out.data.push_back((run & 0x7F) | 0x80);
+                run >>= 7;
+            }
+            out.data.push_back(run);
+            out.data.push_back(index);
+        }
+        return;
+    }
+
+    out.encoding = DENSE_PALETTE_PACKED;
+    out.data.resize(packed_bytes);
+    int bits = out.bits_per_index;
+    int per_byte = 8 / bits;
+    size_t full_bytes = n / per_byte;
+    for (size_t b = 0; b < full_bytes; b++) {
+        const uint8_t* src = pixels + b * per_byte;
+        uint32_t packed = 0;
+        for (int k = 0; k < per_byte; k++) {
+            packed = (packed << bits) | index_of[src[k]];
+        }
+        out.data[b] = packed;
+    }
+    if (full_bytes < packed_bytes) {
+        uint32_t packed = 0;
+        int k = 0;
+        for (size_t i = full_bytes * per_byte; i < n; i++, k++) {
+            packed = (packed << bits) | index_of[pixels[i]];
+        }
+        out.data[full_bytes] = packed << (bits * (per_byte - k));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void encode_depth(const float* depth, int width, int height, int downsample, int depth_bits,
+                  DenseMap& out) {
+    static thread_local vector<float> filtered;
+
+    // Same map size as encode_mask, partial edge blocks are kept
+    downsample = max(1, min(downsample, min(width, height)));
+    out.width = (width + downsample - 1) / downsample;
+    out.height = (height + downsample - 1) / downsample;
+    out.palette.clear();
+    out.bits_per_index = 0;
+    size_t n = (size_t)out.width * out.height;
+
+    const float* values = depth;
+    if (downsample > 1) {
+        // Box filter, each output value is the mean of the finite taps that
+        // fall inside the map. A block with none stays NaN.
+        filtered.resize(n);
+        for (int y = 0; y < out.height; y++) {
+            int y0 = y * downsample;
+            int rows = min(downsample, height - y0);
+            float* dst = filtered.data() + (size_t)y * out.width;
+            for (int x = 0; x < out.width; x++) {
+                int x0 = x * downsample;
+                int cols = min(downsample, width - x0);
+                float sum = 0.0f;
+                int count = 0;
+                for (int dy = 0; dy < rows; dy++) {
+                    const float* src = depth + (size_t)(y0 + dy) * width + x0;
+                    for (int dx = 0; dx < cols; dx++) {
+                        float v = src[dx];
+                        bool finite = v > -FLT_MAX && v < FLT_MAX;
+                        sum += finite ? v : 0.0f;
+                        count += finite;
+                    }
+                }
+                dst[x] = count ? sum / count : NAN;
+            }
+        }
+        values = filtered.data();
+    }
+
+    // NaN and inf fail every comparison here, so they never stretch the range
+    float lo = FLT_MAX;
+    float hi = -FLT_MAX;
+    for (size_t i = 0; i < n; i++) {
+        float v = values[i];
+        bool finite = v > -FLT_MAX && v < FLT_MAX;
+        lo = finite && v < lo ? v : lo;
+        hi = finite && v > hi ? v : hi;
+    }
+    if (lo > hi) {
+        lo = hi = 0.0f;
+    }
+
+    bool wide = depth_bits > 8;
+    float levels = wide ? 65535.0f : 255.0f;
+    out.encoding = wide ? DENSE_QUANTIZED_16 : DENSE_QUANTIZED_8;
+    out.depth_offset = lo;
+    out.depth_scale = (hi - lo) / levels;
+    float inv_scale = hi > lo ? levels / (hi - lo) : 0.0f;
+
+    out.data.resize(n * (wide ? 2 : 1));
+    uint8_t* dst = out.data.data();
+    for (size_t i = 0; i < n; i++) {
+        float q = (values[i] - lo) * inv_scale + 0.5f;
+        q = q > 0.0f ? q : 0.0f;
+        q = q < levels ? q : levels;
+        uint32_t level = (uint32_t)q;
+        if (wide) {
+            dst[2 * i] = level & 0xFF;
+            dst[2 * i + 1] = level >> 8;
+        } else {
+            dst[i] = level;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+DenseEncoder::~DenseEncoder() {
+    Stop();
+}
+
+//-----------------------------------------------------------------------------
+
+void DenseEncoder::Start(const Sink& sink) {
+    this->sink = sink;
+    running = true;
+    worker = thread(&DenseEncoder::WorkerLoop, this);
+}
+
+//-----------------------------------------------------------------------------
+
+bool DenseEncoder::Submit(uint64_t request_id, const DenseMap& region, const camera_image_metadata_t& meta,
+                          const char* frame, int downsample, int depth_bits) {
+    {
+        lock_guard<mutex> lock(queue_mtx);
+        if (!running || queued_jobs.size() >= kMaxQueuedJobs) {
+            return false;
+        }
+
+        queued_jobs.emplace_back();
+        Job& job = queued_jobs.back();
+        job.request_id = request_id;
+        job.map = region;
+        job.meta = meta;
+        if (!spare_buffers.empty()) {
+            job.pixels = move(spare_buffers.back());
+            spare_buffers.pop_back();
+        }
+        // The pipe reuses its buffer once the helper callback returns
+        job.pixels.assign(frame, frame + meta.size_bytes);
+        job.downsample = downsample;
+        job.depth_bits = depth_bits;
+    }
+    queue_cv.notify_one();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void DenseEncoder::WorkerLoop() {
+    unique_lock<mutex> lock(queue_mtx);
+    while (true) {
+        queue_cv.wait(lock, [&] { return !queued_jobs.empty() || !running; });
+        if (queued_jobs.empty()) {
+            break;
+        }
+
+        Job job = move(queued_jobs.front());
+        queued_jobs.pop_front();
+        lock.unlock();
+
+        const camera_image_metadata_t& meta = job.meta;
+        size_t num_pixels = (size_t)meta.width * meta.height;
+        if (num_pixels == 0) {
+            cerr << "Empty dense output frame" << endl;
+            job.map.data.clear();
+        } else if (meta.format == IMAGE_FORMAT_RAW8 && job.pixels.size() >= num_pixels) {
+            encode_mask(job.pixels.data(), meta.width, meta.height, job.downsample, job.map);
+        } else if (meta.format == IMAGE_FORMAT_FLOAT32 && job.pixels.size() >= num_pixels * sizeof(float)) {
+            encode_depth(reinterpret_cast<const float *>(job.pixels.data()), meta.width, meta.height,
+                         job.downsample, job.depth_bits, job.map);
+        } else {
+            cerr << "Unsupported dense output format " << meta.format << endl;
+            job.map.data.clear();
+        }
+        sink(job.request_id, move(job.map));
+
+        lock.lock();
+        spare_buffers.push_back(move(job.pixels));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DenseEncoder::Stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(queue_mtx);
+        running = false;
+    }
+    queue_cv.notify_one();
+    worker.join();
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,87 @@
+#ifndef DENSE_ENCODE_H
+#define DENSE_ENCODE_H
+
+#include <modal_pipe_common.h>
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Same values as DenseOutput::Encoding in onboard_compute.proto
+enum DenseEncoding {
+    DENSE_RLE = 0,              // (varint run length, palette index) pairs, row major
+    DENSE_PALETTE_PACKED = 1,   // palette indices packed bits_per_index wide, MSB first
+    DENSE_QUANTIZED_8 = 2,      // depth = depth_offset + depth_scale * q
+    DENSE_QUANTIZED_16 = 3,     // same, little endian uint16
+};
+
+// An encoded segmentation mask or depth map covering one region of a request frame
+struct DenseMap {
+    int region_x;
+    int region_y;
+    int region_width;
+    int region_height;
+    int width;                  // map size after downsampling
+    int height;
+    DenseEncoding encoding;
+    int bits_per_index;
+    vector<int32_t> palette;    // class id of each palette index, masks only
+    float depth_scale;
+    float depth_offset;
+    vector<uint8_t> data;
+};
+
+// Masks (RAW8 class ids) are reduced to the classes present and stored either
+// run-length or bit-packed, whichever is smaller. Depth maps (FLOAT32) are box
+// filtered by downsample and linearly quantized over their finite range.
+// The inner loops are written to auto-vectorize at -O3 and the run scan tests
+// 8 pixels per step, so neither needs per-architecture intrinsics.
+void encode_mask(const uint8_t* mask, int width, int height, int downsample, DenseMap& out);
+void encode_depth(const float* depth, int width, int height, int downsample, int depth_bits,
+                  DenseMap& out);
+
+// Encodes maps on a worker thread so the pipe helper threads only copy.
+// Finished maps (data empty if the frame format is unknown) go to the sink
+// on the worker thread. Submit() fails when kMaxQueuedJobs are waiting.
+class DenseEncoder {
+ public:
+    typedef function<void(uint64_t request_id, DenseMap&& map)> Sink;
+
+    ~DenseEncoder();
+    void Start(const Sink& sink);
+    bool Running() const { return worker.joinable(); }
+    bool Submit(uint64_t request_id, const DenseMap& region, const camera_image_metadata_t& meta,
+                const char* frame, int downsample, int depth_bits);
+    void Stop();
+
+ private:
+    static const size_t kMaxQueuedJobs = 8;
+
+    struct Job {
+        uint64_t request_id;
+        DenseMap map;
+        camera_image_metadata_t meta;
+        vector<uint8_t> pixels;
+        int downsample;
+        int depth_bits;
+    };
+
+    void WorkerLoop();
+
+    Sink sink;
+    mutex queue_mtx;
+    condition_variable queue_cv;
+    deque<Job> queued_jobs;
+    vector<vector<uint8_t>> spare_buffers;  // recycled pixel copies
+    bool running = false;
+    thread worker;
+};
+
+#endif // DENSE_ENCODE_H
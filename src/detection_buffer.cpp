@@ -0,0 +1,145 @@
+#include "detection_buffer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+const size_t DetectionBuffer::kInitialCapacity;
+
+//-----------------------------------------------------------------------------
+
+NameTable::NameTable() {
+    memset(slots, 0, sizeof(slots));
+    names.reserve(kMaxNames);
+    names.push_back(string());
+}
+
+//-----------------------------------------------------------------------------
+
+uint16_t NameTable::Intern(const char* name, size_t max_len) {
+    size_t len = strnlen(name, max_len);
+    if (len == 0) {
+        return 0;
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+
+    lock_guard<mutex> lock(mtx);
+    for (size_t probe = 0; probe < kSlots; probe++) {
+        uint16_t& slot = slots[(hash + probe) & (kSlots - 1)];
+        if (slot == 0) {
+            if (names.size() >= kMaxNames) {
+                static bool warned = false;
+                if (!warned) {
+                    cerr << "Name table full, new class and camera names are dropped" << endl;
+                    warned = true;
+                }
+                return 0;
+            }
+            names.emplace_back(name, len);
+            slot = names.size();
+            return slot - 1;
+        }
+        const string& existing = names[slot - 1];
+        if (existing.size() == len && memcmp(existing.data(), name, len) == 0) {
+            return slot - 1;
+        }
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+const string& NameTable::Name(uint16_t id) const {
+    lock_guard<mutex> lock(mtx);
+    return id < names.size() ? names[id] : names[0];
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionBuffer::Reserve(size_t capacity) {
+    if (capacity <= Capacity()) {
+        return;
+    }
+    timestamp_ns.resize(capacity);
+    frame_id.resize(capacity);
+    class_id.resize(capacity);
+    class_name.resize(capacity);
+    cam.resize(capacity);
+    class_confidence.resize(capacity);
+    detection_confidence.resize(capacity);
+    x_min.resize(capacity);
+    y_min.resize(capacity);
+    x_max.resize(capacity);
+    y_max.resize(capacity);
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionBuffer::Swap(DetectionBuffer& other) {
+    timestamp_ns.swap(other.timestamp_ns);
+    frame_id.swap(other.frame_id);
+    class_id.swap(other.class_id);
+    class_name.swap(other.class_name);
+    cam.swap(other.cam);
+    class_confidence.swap(other.class_confidence);
+    detection_confidence.swap(other.detection_confidence);
+    x_min.swap(other.x_min);
+    y_min.swap(other.y_min);
+    x_max.swap(other.x_max);
+    y_max.swap(other.y_max);
+    std::swap(size, other.size);
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionBuffer::AppendPacked(const char* data, int bytes, NameTable& names) {
+    size_t num_records = bytes > 0 ? bytes / sizeof(ai_detection_t) : 0;
+    if (size + num_records > Capacity()) {
+        Reserve(max(max(kInitialCapacity, 2 * Capacity()), size + num_records));
+    }
+
+    for (size_t r = 0; r < num_records; r++, size++) {
+        // Records are packed, the compiler reads each field unaligned
+        const ai_detection_t* detection = reinterpret_cast<const ai_detection_t *>(data) + r;
+        timestamp_ns[size] = detection->timestamp_ns;
+        frame_id[size] = detection->frame_id;
+        class_id[size] = detection->class_id;
+        class_name[size] = names.Intern(detection->class_name, BUF_LEN);
+        cam[size] = names.Intern(detection->cam, BUF_LEN);
+        class_confidence[size] = detection->class_confidence;
+        detection_confidence[size] = detection->detection_confidence;
+        x_min[size] = detection->x_min;
+        y_min[size] = detection->y_min;
+        x_max[size] = detection->x_max;
+        y_max[size] = detection->y_max;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionBuffer::AppendFrom(const DetectionBuffer& other, size_t i) {
+    if (size == Capacity()) {
+        Reserve(max(kInitialCapacity, 2 * size));
+    }
+
+    timestamp_ns[size] = other.timestamp_ns[i];
+    frame_id[size] = other.frame_id[i];
+    class_id[size] = other.class_id[i];
+    class_name[size] = other.class_name[i];
+    cam[size] = other.cam[i];
+    class_confidence[size] = other.class_confidence[i];
+    detection_confidence[size] = other.detection_confidence[i];
+    x_min[size] = other.x_min[i];
+    y_min[size] = other.y_min[i];
+    x_max[size] = other.x_max[i];
+    y_max[size] = other.y_max[i];
+    size++;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,75 @@
+#ifndef DETECTION_BUFFER_H
+#define DETECTION_BUFFER_H
+
+#include <ai_detection.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Class and camera names interned to 16 bit ids, so a detection carries two
+// ids instead of two 64 byte arrays. A name is hashed where it lies and only
+// allocates the first time it is seen. Id 0 is the empty name, also handed
+// out once kMaxNames are taken.
+class NameTable {
+ public:
+    NameTable();
+    uint16_t Intern(const char* name, size_t max_len);
+    uint16_t Intern(const string& name) { return Intern(name.c_str(), name.size()); }
+    const string& Name(uint16_t id) const;
+
+ private:
+    static const size_t kMaxNames = 1024;
+    static const size_t kSlots = 2 * kMaxNames;     // power of two, kept at most half full
+
+    mutable mutex mtx;
+    uint16_t slots[kSlots];                         // id + 1, 0 when empty
+    vector<string> names;                           // reserved up front, so references stay valid
+};
+
+// Detections in struct-of-arrays form. Storage is kept across Clear(), so a
+// buffer that is reused only allocates until it has seen its largest frame.
+// Filtering and box mapping touch just the arrays they need.
+struct DetectionBuffer {
+    static const size_t kInitialCapacity = 64;
+
+    DetectionBuffer() {}
+    DetectionBuffer(const DetectionBuffer& other) = default;
+    DetectionBuffer& operator=(const DetectionBuffer& other) = default;
+    // Moves swap storage, so a moved-from buffer is empty but consistent
+    DetectionBuffer(DetectionBuffer&& other) : size(0) { Swap(other); }
+    DetectionBuffer& operator=(DetectionBuffer&& other) { Swap(other); return *this; }
+
+    size_t Size() const { return size; }
+    size_t Capacity() const { return timestamp_ns.size(); }
+    void Clear() { size = 0; }
+    void Reserve(size_t capacity);
+    void Swap(DetectionBuffer& other);
+
+    // Unpacks whole ai_detection_t records straight from a pipe or log buffer
+    void AppendPacked(const char* data, int bytes, NameTable& names);
+    // Copies detection i of other
+    void AppendFrom(const DetectionBuffer& other, size_t i);
+
+    vector<int64_t> timestamp_ns;
+    vector<int32_t> frame_id;                       // -1 for delimiters
+    vector<uint32_t> class_id;
+    vector<uint16_t> class_name;                    // NameTable ids
+    vector<uint16_t> cam;
+    vector<float> class_confidence;
+    vector<float> detection_confidence;
+    vector<float> x_min;
+    vector<float> y_min;
+    vector<float> x_max;
+    vector<float> y_max;
+
+ private:
+    size_t size = 0;
+};
+
+#endif // DETECTION_BUFFER_H
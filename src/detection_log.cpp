@@ -0,0 +1,345 @@
+#include "detection_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#define LOG_GROW_BYTES (16 * 1024 * 1024)
+
+//-----------------------------------------------------------------------------
+
+int64_t monotonic_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+
+MappedLogWriter::~MappedLogWriter() {
+    Close();
+}
+
+//-----------------------------------------------------------------------------
+
+bool MappedLogWriter::Open(const string& path, uint32_t record_size, uint32_t magic_number) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Could not open log file " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    this->record_size = record_size;
+    count = 0;
+
+    if (!Grow(LOG_GROW_BYTES)) {
+        return false;
+    }
+
+    detection_log_header_t* header = reinterpret_cast<detection_log_header_t *>(base);
+    header->magic_number = magic_number;
+    header->version = DETECTION_LOG_VERSION;
+    header->record_size = record_size;
+    header->count = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool MappedLogWriter::Grow(size_t min_bytes) {
+    size_t new_bytes = mapped_bytes;
+    while (new_bytes < min_bytes) {
+        new_bytes += LOG_GROW_BYTES;
+    }
+
+    if (ftruncate(fd, new_bytes)) {
+        cerr << "Could not grow log file: " << strerror(errno) << endl;
+        return false;
+    }
+
+    void* mapped = base ? mremap(base, mapped_bytes, new_bytes, MREMAP_MAYMOVE)
+                        : mmap(nullptr, new_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        cerr << "Could not map log file: " << strerror(errno) << endl;
+        return false;
+    }
+    base = static_cast<uint8_t *>(mapped);
+    mapped_bytes = new_bytes;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool MappedLogWriter::Append(const void* records, uint64_t num_records) {
+    size_t offset = sizeof(detection_log_header_t) + count * record_size;
+    size_t bytes = num_records * record_size;
+    if (offset + bytes > mapped_bytes && !Grow(offset + bytes)) {
+        return false;
+    }
+
+    memcpy(base + offset, records, bytes);
+    count += num_records;
+
+    // Publish after the records so readers never see a partial batch
+    detection_log_header_t* header = reinterpret_cast<detection_log_header_t *>(base);
+    __atomic_store_n(&header->count, count, __ATOMIC_RELEASE);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void MappedLogWriter::Close() {
+    if (base) {
+        munmap(base, mapped_bytes);
+        base = nullptr;
+    }
+    if (fd >= 0) {
+        // Trim the preallocated tail
+        if (ftruncate(fd, sizeof(detection_log_header_t) + count * record_size)) {
+            cerr << "Could not trim log file: " << strerror(errno) << endl;
+        }
+        close(fd);
+        fd = -1;
+    }
+    mapped_bytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+MappedLogReader::~MappedLogReader() {
+    if (base) {
+        munmap(base, mapped_bytes);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool MappedLogReader::Open(const string& path, uint32_t record_size, uint32_t magic_number) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Could not open log file " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(detection_log_header_t)) {
+        cerr << "Log file " << path << " is truncated" << endl;
+        return false;
+    }
+
+    mapped_bytes = st.st_size;
+    void* mapped = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        cerr << "Could not map log file " << path << ": " << strerror(errno) << endl;
+        mapped_bytes = 0;
+        return false;
+    }
+    base = static_cast<uint8_t *>(mapped);
+
+    const detection_log_header_t* header = reinterpret_cast<const detection_log_header_t *>(base);
+    if (header->magic_number != magic_number || header->version != DETECTION_LOG_VERSION ||
+        header->record_size != record_size) {
+        cerr << "Log file " << path << " has an unexpected header" << endl;
+        return false;
+    }
+
+    this->record_size = record_size;
+    uint64_t available = (mapped_bytes - sizeof(detection_log_header_t)) / record_size;
+    count = min<uint64_t>(__atomic_load_n(&header->count, __ATOMIC_ACQUIRE), available);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+const void* MappedLogReader::Record(uint64_t i) const {
+    return base + sizeof(detection_log_header_t) + i * record_size;
+}
+
+//-----------------------------------------------------------------------------
+
+DetectionRecorder::~DetectionRecorder() {
+    Stop();
+}
+
+//-----------------------------------------------------------------------------
+
+bool DetectionRecorder::Start(const string& path) {
+    if (!data_log.Open(path, sizeof(ai_detection_t)) ||
+        !index_log.Open(path + DETECTION_LOG_INDEX_EXT, sizeof(detection_log_index_t))) {
+        return false;
+    }
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        cerr << "Could not create recorder wakeup: " << strerror(errno) << endl;
+        return false;
+    }
+    ring.reset(new Slot[kRingSlots]);
+    running = true;
+    writer = thread(&DetectionRecorder::WriterLoop, this);
+    cout << "Recording detections to " << path << endl;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionRecorder::Append(const char* data, int bytes) {
+    int64_t now = monotonic_time_ns();
+    int num_records = bytes / (int)sizeof(ai_detection_t);
+    if (num_records <= 0 || !running.load(memory_order_relaxed)) {
+        return;
+    }
+
+    // Batches larger than a slot are split; replay treats them as separate
+    // callbacks. A batch is dropped whole, a partial one would lose its delimiter.
+    // Its slots are claimed together, so another camera's batch can't land
+    // between them.
+    uint64_t slots_needed = (num_records + kMaxBatchRecords - 1) / kMaxBatchRecords;
+    uint64_t h = head.load(memory_order_relaxed);
+    do {
+        if (h - tail.load(memory_order_acquire) + slots_needed > (uint64_t)kRingSlots) {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+    } while (!head.compare_exchange_weak(h, h + slots_needed, memory_order_relaxed));
+
+    for (int off = 0; off < num_records; off += kMaxBatchRecords, h++) {
+        Slot& slot = ring[h % kRingSlots];
+        slot.recv_time_ns = now;
+        int remaining = num_records - off;
+        slot.num_records = remaining < kMaxBatchRecords ? remaining : kMaxBatchRecords;
+        memcpy(slot.records, data + off * sizeof(ai_detection_t),
+               slot.num_records * sizeof(ai_detection_t));
+        slot.filled.store(h + 1, memory_order_release);
+    }
+
+    // Never blocks, the counter can't come near overflowing
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        cerr << "Could not wake detection log writer" << endl;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionRecorder::WriterLoop() {
+    while (true) {
+        uint64_t t = tail.load(memory_order_relaxed);
+        const Slot& slot = ring[t % kRingSlots];
+        // Empty, or claimed by a producer that is still copying into it
+        if (slot.filled.load(memory_order_acquire) != t + 1) {
+            if (!running) {
+                break;
+            }
+            // Sleeps until Append or Stop signals, a signal sent since the
+            // check above makes it return straight away
+            uint64_t wakeups;
+            if (read(wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR) {
+                cerr << "Could not wait for detections: " << strerror(errno) << endl;
+                break;
+            }
+            continue;
+        }
+
+        detection_log_index_t entry;
+        entry.recv_time_ns = slot.recv_time_ns;
+        entry.first_record = data_log.Count();
+        entry.num_records = slot.num_records;
+        entry.reserved = 0;
+
+        if (!data_log.Append(slot.records, slot.num_records) || !index_log.Append(&entry, 1)) {
+            cerr << "Detection log write failed, stopping recorder" << endl;
+            running = false;
+            break;
+        }
+        tail.store(t + 1, memory_order_release);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionRecorder::Stop() {
+    if (writer.joinable()) {
+        running = false;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            cerr << "Could not wake detection log writer" << endl;
+        }
+        writer.join();
+        cout << "Recorded " << index_log.Count() << " detection batches ("
+             << dropped.load() << " dropped)" << endl;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    data_log.Close();
+    index_log.Close();
+}
+
+//-----------------------------------------------------------------------------
+
+bool DetectionReplayer::Open(const string& path, bool realtime) {
+    if (!data_log.Open(path, sizeof(ai_detection_t)) ||
+        !index_log.Open(path + DETECTION_LOG_INDEX_EXT, sizeof(detection_log_index_t))) {
+        return false;
+    }
+    if (index_log.Count() == 0) {
+        cerr << "Detection log " << path << " is empty" << endl;
+        return false;
+    }
+
+    this->realtime = realtime;
+    cout << "Replaying " << index_log.Count() << " detection batches from " << path
+         << (realtime ? " at recorded speed" : " at maximum speed") << endl;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void DetectionReplayer::ReplayNextFrame(const function<void(const char* data, int bytes)>& sink) {
+    bool delimited = false;
+    // Bounded so a log without any delimiter can't spin forever
+    for (uint64_t visited = 0; !delimited && visited <= index_log.Count(); visited++) {
+        if (next_batch >= index_log.Count()) {
+            cout << "Reached end of detection log, rewinding" << endl;
+            next_batch = 0;
+        }
+
+        const detection_log_index_t* entry =
+            static_cast<const detection_log_index_t *>(index_log.Record(next_batch));
+        if (next_batch == 0) {
+            wall_start_ns = monotonic_time_ns();
+            log_start_ns = entry->recv_time_ns;
+        }
+        next_batch++;
+
+        if (entry->num_records == 0 || entry->first_record + entry->num_records > data_log.Count()) {
+            continue;
+        }
+
+        if (realtime) {
+            int64_t wait_ns = (entry->recv_time_ns - log_start_ns) - (monotonic_time_ns() - wall_start_ns);
+            if (wait_ns > 0) {
+                this_thread::sleep_for(chrono::nanoseconds(wait_ns));
+            }
+        }
+
+        const ai_detection_t* first = static_cast<const ai_detection_t *>(data_log.Record(entry->first_record));
+        delimited = first[entry->num_records - 1].frame_id == -1;
+        sink(reinterpret_cast<const char *>(first), entry->num_records * sizeof(ai_detection_t));
+    }
+}
+
+//-----------------------------------------------------------------------------
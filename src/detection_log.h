@@ -0,0 +1,131 @@
+#ifndef DETECTION_LOG_H
+#define DETECTION_LOG_H
+
+#include <ai_detection.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define DETECTION_LOG_MAGIC     0x474F4C44  // "DLOG"
+#define DETECTION_LOG_VERSION   1
+#define DETECTION_LOG_INDEX_EXT ".idx"
+
+// Both files of a log start with this header followed by count fixed size
+// records. count is only advanced after the records it covers are written,
+// so a log cut short by a crash is still readable up to the last batch.
+typedef struct detection_log_header_t {
+    uint32_t magic_number;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+} __attribute__((packed)) detection_log_header_t;
+
+// one entry per tflite_data callback, in the "<log>.idx" file
+typedef struct detection_log_index_t {
+    int64_t  recv_time_ns;  // CLOCK_MONOTONIC time the batch arrived
+    uint64_t first_record;  // index of the batch's first ai_detection_t in the data file
+    uint32_t num_records;
+    uint32_t reserved;
+} __attribute__((packed)) detection_log_index_t;
+
+int64_t monotonic_time_ns();
+
+// Append-only file of fixed size records, grown and remapped in chunks.
+// A record_size of 1 turns it into a plain byte log (see frame_capture.h).
+class MappedLogWriter {
+ public:
+    ~MappedLogWriter();
+    bool Open(const string& path, uint32_t record_size, uint32_t magic_number = DETECTION_LOG_MAGIC);
+    bool Append(const void* records, uint64_t num_records);
+    void Close();
+    uint64_t Count() const { return count; }
+
+ private:
+    bool Grow(size_t min_bytes);
+
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t mapped_bytes = 0;
+    uint32_t record_size = 0;
+    uint64_t count = 0;
+};
+
+// Read-only view of a file written by MappedLogWriter
+class MappedLogReader {
+ public:
+    ~MappedLogReader();
+    bool Open(const string& path, uint32_t record_size, uint32_t magic_number = DETECTION_LOG_MAGIC);
+    const void* Record(uint64_t i) const;
+    uint64_t Count() const { return count; }
+
+ private:
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t mapped_bytes = 0;
+    uint32_t record_size = 0;
+    uint64_t count = 0;
+};
+
+// Records every detection batch from tflite_server_cb. Each camera's pipe
+// helper thread calls Append(), which claims ring slots with a CAS and only
+// copies, so producers never wait on each other or on the disk. A writer
+// thread, woken through an eventfd, moves batches into the mapped log in
+// claim order. Batches are dropped whole (and counted) if the ring can't take
+// all of one.
+class DetectionRecorder {
+ public:
+    ~DetectionRecorder();
+    bool Start(const string& path);
+    void Append(const char* data, int bytes);
+    void Stop();
+
+ private:
+    static const int kMaxBatchRecords = 16;
+    static const int kRingSlots = 1024;
+
+    struct Slot {
+        atomic<uint64_t> filled{0}; // claim position + 1 once the records are in
+        int64_t recv_time_ns;
+        uint32_t num_records;
+        ai_detection_t records[kMaxBatchRecords];
+    };
+
+    void WriterLoop();
+
+    MappedLogWriter data_log;
+    MappedLogWriter index_log;
+    unique_ptr<Slot[]> ring;
+    atomic<uint64_t> head{0};   // next slot a producer claims
+    atomic<uint64_t> tail{0};   // next slot the writer drains
+    atomic<bool> running{false};
+    atomic<uint64_t> dropped{0};
+    int wake_fd = -1;           // eventfd, signalled for every batch appended
+    thread writer;
+};
+
+// Streams a recorded log back one frame (up to and including a delimiter
+// record) at a time, either as fast as possible or at the recorded pacing.
+// Loops back to the start when the log is exhausted.
+class DetectionReplayer {
+ public:
+    bool Open(const string& path, bool realtime);
+    // sink gets packed ai_detection_t records, as tflite_server_cb does
+    void ReplayNextFrame(const function<void(const char* data, int bytes)>& sink);
+
+ private:
+    MappedLogReader data_log;
+    MappedLogReader index_log;
+    bool realtime = false;
+    uint64_t next_batch = 0;
+    int64_t wall_start_ns = 0;
+    int64_t log_start_ns = 0;
+};
+
+#endif // DETECTION_LOG_H
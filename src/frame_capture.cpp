@@ -0,0 +1,210 @@
+#include "frame_capture.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <iostream>
+
+//-----------------------------------------------------------------------------
+
+FrameCapture::~FrameCapture() {
+    Stop();
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameCapture::Start(const string& path, bool compress) {
+    if (!log.Open(path, 1, FRAME_CAPTURE_MAGIC)) {
+        return false;
+    }
+
+    this->compress = compress;
+    running = true;
+    writer = thread(&FrameCapture::WriterLoop, this);
+    cout << "Capturing frames to " << path << (compress ? " (compressed)" : "") << endl;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void FrameCapture::Append(const string& serialized_request, const string& sender_key, int64_t arrival_time_ns) {
+    frame_capture_record_t record;
+    record.arrival_time_ns = arrival_time_ns;
+    record.sender_key_size = min<size_t>(sender_key.size(), UINT16_MAX);
+    record.size = serialized_request.size();
+
+    vector<uint8_t>& payload = open_chunk.payload;
+    size_t offset = payload.size();
+    payload.resize(offset + sizeof(record) + record.sender_key_size + record.size);
+    uint8_t* dst = payload.data() + offset;
+    memcpy(dst, &record, sizeof(record));
+    memcpy(dst + sizeof(record), sender_key.data(), record.sender_key_size);
+    memcpy(dst + sizeof(record) + record.sender_key_size, serialized_request.data(), record.size);
+    open_chunk.num_frames++;
+    frames_captured++;
+
+    if (payload.size() < kChunkBytes) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(queue_mtx);
+        if (queued_chunks.size() < kMaxQueuedChunks) {
+            queued_chunks.push_back(move(open_chunk));
+        } else {
+            chunks_dropped++;
+        }
+    }
+    queue_cv.notify_one();
+    open_chunk = Chunk();
+    open_chunk.payload.reserve(kChunkBytes + sizeof(record) + record.sender_key_size + record.size);
+}
+
+//-----------------------------------------------------------------------------
+
+void FrameCapture::WriterLoop() {
+    unique_lock<mutex> lock(queue_mtx);
+    while (true) {
+        queue_cv.wait(lock, [&] { return !queued_chunks.empty() || !running; });
+        if (queued_chunks.empty()) {
+            break;
+        }
+
+        Chunk chunk = move(queued_chunks.front());
+        queued_chunks.pop_front();
+
+        lock.unlock();
+        bool ok = WriteChunk(chunk);
+        lock.lock();
+
+        if (!ok) {
+            cerr << "Frame capture write failed, stopping capture" << endl;
+            queued_chunks.clear();
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameCapture::WriteChunk(const Chunk& chunk) {
+    frame_capture_chunk_t header;
+    header.magic_number = FRAME_CAPTURE_CHUNK_MAGIC;
+    header.num_frames = chunk.num_frames;
+    header.raw_bytes = chunk.payload.size();
+    header.stored_bytes = chunk.payload.size();
+
+    const uint8_t* stored = chunk.payload.data();
+    vector<uint8_t> deflated;
+    if (compress) {
+        uLongf deflated_bytes = compressBound(chunk.payload.size());
+        deflated.resize(deflated_bytes);
+        // Level 1: camera frames barely gain from harder levels and capture must keep up
+        if (compress2(deflated.data(), &deflated_bytes, chunk.payload.data(),
+                      chunk.payload.size(), Z_BEST_SPEED) == Z_OK &&
+            deflated_bytes < chunk.payload.size()) {
+            stored = deflated.data();
+            header.stored_bytes = deflated_bytes;
+        }
+    }
+
+    return log.Append(&header, sizeof(header)) && log.Append(stored, header.stored_bytes);
+}
+
+//-----------------------------------------------------------------------------
+
+void FrameCapture::Stop() {
+    if (!writer.joinable()) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(queue_mtx);
+        if (open_chunk.num_frames > 0) {
+            queued_chunks.push_back(move(open_chunk));
+            open_chunk = Chunk();
+        }
+        running = false;
+    }
+    queue_cv.notify_one();
+    writer.join();
+    log.Close();
+    cout << "Captured " << frames_captured << " frames (" << chunks_dropped << " chunks dropped)" << endl;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameCaptureReader::Open(const string& path) {
+    if (!log.Open(path, 1, FRAME_CAPTURE_MAGIC)) {
+        return false;
+    }
+    cout << "Replaying " << log.Count() << " bytes of captured frames from " << path << endl;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameCaptureReader::LoadChunk() {
+    if (chunk_offset + sizeof(frame_capture_chunk_t) > log.Count()) {
+        return false;
+    }
+
+    frame_capture_chunk_t header;
+    memcpy(&header, log.Record(chunk_offset), sizeof(header));
+    uint64_t payload_offset = chunk_offset + sizeof(header);
+    if (header.magic_number != FRAME_CAPTURE_CHUNK_MAGIC ||
+        payload_offset + header.stored_bytes > log.Count()) {
+        cerr << "Frame capture is corrupt at offset " << chunk_offset << endl;
+        return false;
+    }
+
+    const uint8_t* stored = static_cast<const uint8_t *>(log.Record(payload_offset));
+    chunk_payload.resize(header.raw_bytes);
+    if (header.stored_bytes == header.raw_bytes) {
+        memcpy(chunk_payload.data(), stored, header.raw_bytes);
+    } else {
+        uLongf raw_bytes = header.raw_bytes;
+        if (uncompress(chunk_payload.data(), &raw_bytes, stored, header.stored_bytes) != Z_OK ||
+            raw_bytes != header.raw_bytes) {
+            cerr << "Could not inflate frame capture chunk at offset " << chunk_offset << endl;
+            return false;
+        }
+    }
+
+    chunk_offset = payload_offset + header.stored_bytes;
+    frame_offset = 0;
+    frames_left = header.num_frames;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameCaptureReader::Next(int64_t& arrival_time_ns, string& sender_key, string& serialized_request) {
+    while (frames_left == 0) {
+        if (!LoadChunk()) {
+            return false;
+        }
+    }
+
+    frame_capture_record_t record;
+    if (frame_offset + sizeof(record) > chunk_payload.size()) {
+        return false;
+    }
+    memcpy(&record, chunk_payload.data() + frame_offset, sizeof(record));
+    frame_offset += sizeof(record);
+    if (frame_offset + record.sender_key_size + record.size > chunk_payload.size()) {
+        return false;
+    }
+
+    arrival_time_ns = record.arrival_time_ns;
+    sender_key.assign(reinterpret_cast<const char *>(chunk_payload.data() + frame_offset), record.sender_key_size);
+    frame_offset += record.sender_key_size;
+    serialized_request.assign(reinterpret_cast<const char *>(chunk_payload.data() + frame_offset), record.size);
+    frame_offset += record.size;
+    frames_left--;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
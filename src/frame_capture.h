@@ -0,0 +1,90 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "detection_log.h"
+
+using namespace std;
+
+#define FRAME_CAPTURE_MAGIC         0x50414346  // "FCAP"
+#define FRAME_CAPTURE_CHUNK_MAGIC   0x4B4E4843  // "CHNK"
+
+// A capture is a MappedLogWriter byte log made of chunks. Each chunk is this
+// header followed by stored_bytes of payload, zlib deflated when that made it
+// smaller (stored_bytes < raw_bytes). Inflated, the payload is num_frames
+// frame_capture_record_t headers, each followed by the sender key and then a
+// serialized ComputeRequest.
+typedef struct frame_capture_chunk_t {
+    uint32_t magic_number;
+    uint32_t num_frames;
+    uint32_t raw_bytes;
+    uint32_t stored_bytes;
+} __attribute__((packed)) frame_capture_chunk_t;
+
+typedef struct frame_capture_record_t {
+    int64_t  arrival_time_ns;   // CLOCK_MONOTONIC time the request was received
+    uint16_t sender_key_size;   // sender key bytes that follow, empty for the REP frontend
+    uint32_t size;              // serialized ComputeRequest bytes after the sender key
+} __attribute__((packed)) frame_capture_record_t;
+
+// Captures raw client requests with the sender key their tile deltas are
+// reconstructed under, so a replay rebuilds each sender's frames against its
+// own reference. Append() only copies into the open chunk;
+// full chunks are compressed and written by a background thread, and are
+// dropped (and counted) if more than kMaxQueuedChunks are waiting.
+class FrameCapture {
+ public:
+    ~FrameCapture();
+    bool Start(const string& path, bool compress);
+    void Append(const string& serialized_request, const string& sender_key, int64_t arrival_time_ns);
+    void Stop();
+
+ private:
+    static const size_t kChunkBytes = 8 * 1024 * 1024;
+    static const size_t kMaxQueuedChunks = 8;
+
+    struct Chunk {
+        uint32_t num_frames = 0;
+        vector<uint8_t> payload;
+    };
+
+    void WriterLoop();
+    bool WriteChunk(const Chunk& chunk);
+
+    MappedLogWriter log;
+    bool compress = false;
+    Chunk open_chunk;
+
+    mutex queue_mtx;
+    condition_variable queue_cv;
+    deque<Chunk> queued_chunks;
+    bool running = false;
+    uint64_t frames_captured = 0;
+    uint64_t chunks_dropped = 0;
+    thread writer;
+};
+
+// Reads a capture back in order, inflating one chunk at a time
+class FrameCaptureReader {
+ public:
+    bool Open(const string& path);
+    // Returns false once the capture is exhausted
+    bool Next(int64_t& arrival_time_ns, string& sender_key, string& serialized_request);
+
+ private:
+    bool LoadChunk();
+
+    MappedLogReader log;
+    uint64_t chunk_offset = 0;
+    vector<uint8_t> chunk_payload;
+    size_t frame_offset = 0;
+    uint32_t frames_left = 0;
+};
+
+#endif // FRAME_CAPTURE_H
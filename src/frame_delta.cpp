@@ -0,0 +1,122 @@
+#include "frame_delta.h"
+#include "onboard_compute.pb.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace steeleagle;
+
+//-----------------------------------------------------------------------------
+
+bool apply_tile_delta(uint8_t* frame, int width, int height, int tile_width, int tile_height,
+                      const uint8_t* changed_tiles, size_t changed_tiles_bytes,
+                      const uint8_t* tiles, size_t tiles_bytes) {
+    // Tiles must start on a chroma pair
+    if (width <= 0 || height <= 0 || tile_width <= 0 || tile_height <= 0 || (tile_width & 1)) {
+        return false;
+    }
+    // Tiles come from the client, one larger than the frame just covers all of it
+    tile_width = min(tile_width, width);
+    tile_height = min(tile_height, height);
+    int cols = (width + tile_width - 1) / tile_width;
+    int rows = (height + tile_height - 1) / tile_height;
+    if (changed_tiles_bytes < ((size_t)cols * rows + 7) / 8) {
+        return false;
+    }
+
+    // Size everything up first so a bad delta can't leave a half patched reference
+    size_t expected_bytes = 0;
+    for (int ty = 0; ty < rows; ty++) {
+        int th = min(tile_height, height - ty * tile_height);
+        for (int tx = 0; tx < cols; tx++) {
+            size_t t = (size_t)ty * cols + tx;
+            if (changed_tiles[t >> 3] & (1 << (t & 7))) {
+                expected_bytes += (size_t)min(tile_width, width - tx * tile_width) * th * 2;
+            }
+        }
+    }
+    if (expected_bytes != tiles_bytes) {
+        return false;
+    }
+
+    size_t row_bytes = (size_t)width * 2;
+    for (int ty = 0; ty < rows; ty++) {
+        int th = min(tile_height, height - ty * tile_height);
+        for (int tx = 0; tx < cols; tx++) {
+            size_t t = (size_t)ty * cols + tx;
+            if (!(changed_tiles[t >> 3] & (1 << (t & 7)))) {
+                continue;
+            }
+            size_t tile_row_bytes = (size_t)min(tile_width, width - tx * tile_width) * 2;
+            uint8_t* dst = frame + (size_t)ty * tile_height * row_bytes + (size_t)tx * tile_width * 2;
+            for (int r = 0; r < th; r++) {
+                memcpy(dst, tiles, tile_row_bytes);
+                dst += row_bytes;
+                tiles += tile_row_bytes;
+            }
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool FrameReferences::Reconstruct(const string& key, ComputeRequest& request) {
+    if (!request.has_delta()) {
+        return true;
+    }
+
+    const TileDelta& delta = request.delta();
+    auto it = references.find(key);
+    if (it == references.end()) {
+        cerr << "Tile delta for " << key << " has no reference frame" << endl;
+        return false;
+    }
+
+    Reference& reference = it->second;
+    reference.last_used = ++uses;
+    if (reference.sequence != delta.reference_sequence() ||
+        reference.width != request.frame_width() || reference.height != request.frame_height() ||
+        reference.frame.size() != (size_t)reference.width * reference.height * 2 ||
+        !apply_tile_delta(reinterpret_cast<uint8_t *>(&reference.frame[0]), reference.width, reference.height,
+                          delta.tile_width(), delta.tile_height(),
+                          reinterpret_cast<const uint8_t *>(delta.changed_tiles().data()), delta.changed_tiles().size(),
+                          reinterpret_cast<const uint8_t *>(request.frame_data().data()), request.frame_data().size())) {
+        cerr << "Tile delta for " << key << " does not match its reference frame" << endl;
+        references.erase(it);
+        return false;
+    }
+
+    request.mutable_frame_data()->swap(reference.frame);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void FrameReferences::Keep(const string& key, ComputeRequest& request) {
+    if (request.frame_sequence() == 0) {
+        references.erase(key);
+        return;
+    }
+
+    // Makes room by forgetting the reference that went unused the longest
+    if (references.size() >= kMaxReferences && references.find(key) == references.end()) {
+        auto oldest = references.begin();
+        for (auto it = references.begin(); it != references.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) {
+                oldest = it;
+            }
+        }
+        references.erase(oldest);
+    }
+    Reference& reference = references[key];
+    reference.last_used = ++uses;
+    reference.sequence = request.frame_sequence();
+    reference.width = request.frame_width();
+    reference.height = request.frame_height();
+    reference.frame.swap(*request.mutable_frame_data());
+}
+
+//-----------------------------------------------------------------------------
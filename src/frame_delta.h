@@ -0,0 +1,57 @@
+#ifndef FRAME_DELTA_H
+#define FRAME_DELTA_H
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+namespace steeleagle {
+class ComputeRequest;
+}
+
+// Reference frames for the tile delta wire mode (see TileDelta in
+// onboard_compute.proto). A delta request carries only the tiles that changed
+// since its reference; Reconstruct() patches them into the kept reference and
+// hands the full frame to the request without copying it, Keep() takes it
+// back once the frame has been written to the pipe.
+class FrameReferences {
+ public:
+    // Replaces a delta request's frame_data with the full frame. Returns false
+    // (and forgets key's reference) if the reference is unknown or the delta
+    // doesn't fit it. Requests without a delta are left alone.
+    bool Reconstruct(const string& key, steeleagle::ComputeRequest& request);
+
+    // Keeps the request's full frame as key's reference when it names itself
+    // with frame_sequence, or forgets key's reference when it doesn't. Takes
+    // frame_data from the request.
+    void Keep(const string& key, steeleagle::ComputeRequest& request);
+
+ private:
+    struct Reference {
+        uint32_t sequence;
+        int width;
+        int height;
+        string frame;
+        uint64_t last_used;     // value of uses when last reconstructed or kept
+    };
+
+    // Every client and camera pair keeps a full frame, the least recently used
+    // one is forgotten when this many pile up
+    static const size_t kMaxReferences = 16;
+
+    unordered_map<string, Reference> references;
+    uint64_t uses = 0;
+};
+
+// Copies each changed tile of a packed YUV422 frame into frame. tiles holds the
+// changed tiles in row major tile order, each tile's rows back to back and
+// clipped at the right and bottom edges. Returns false, leaving frame
+// untouched, if the sizes don't add up.
+bool apply_tile_delta(uint8_t* frame, int width, int height, int tile_width, int tile_height,
+                      const uint8_t* changed_tiles, size_t changed_tiles_bytes,
+                      const uint8_t* tiles, size_t tiles_bytes);
+
+#endif // FRAME_DELTA_H
@@ -0,0 +1,238 @@
+#include <iostream>
+
+#include "onboard_compute_engine.h"
+#include "detection_log.h"
+#include "frame_capture.h"
+#include "zhelpers.hpp"
+#include "gabriel.pb.h"
+#include "onboard_compute.pb.h"
+
+#include <modal_start_stop.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <zmq.hpp>
+
+// Gabriel clients connect with a DEALER socket. Every message is a single
+// frame, seen here as [identity][payload]. An empty payload is a hello and is
+// answered with a Welcome announcing the sources and tokens per source.
+// FromClient frames carry the image in payloads(0) and the rest of the
+// ComputeRequest packed into extras; results come back packed in
+// ResultWrapper.extras as a ComputeResult.
+
+#define GABRIEL_PRODUCER_NAME "steeleagle-os-onboard-compute"
+#define GABRIEL_RESULT_TYPE_URL "type.googleapis.com/steeleagle.ComputeResult"
+
+// Frames accepted from all clients together before new ones are dropped. Each
+// one is a camera frame queued on the onboardcompute pipe.
+#define GABRIEL_MAX_REQUESTS_IN_FLIGHT 8
+
+// Clients silent this long with no tokens out are forgotten. One that comes
+// back is welcomed again like a new client.
+#define GABRIEL_CLIENT_IDLE_MS 60000
+
+//-----------------------------------------------------------------------------
+
+using namespace std;
+using namespace steeleagle;
+
+extern unique_ptr<FrameCapture> capture;
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::HandleGabrielMessages() {
+    zmq::pollitem_t poll_items[2];
+    poll_items[0].socket = (void *)socket;
+    poll_items[0].fd = 0;
+    poll_items[0].events = ZMQ_POLLIN;
+    poll_items[1].socket = nullptr;
+    poll_items[1].fd = completion_fd;
+    poll_items[1].events = ZMQ_POLLIN;
+
+    // Wakes up for the next deadline, and regularly so a shutdown request is noticed
+    int64_t wait_ns = ExpireRequests();
+    ExpireGabrielClients();
+    long timeout_ms = wait_ns < 1000000000 ? (long)((wait_ns + 999999) / 1000000) : 1000;
+    zmq::poll(poll_items, 2, timeout_ms);
+
+    if (poll_items[1].revents & ZMQ_POLLIN) {
+        uint64_t completions;
+        if (read(completion_fd, &completions, sizeof(completions)) < 0) {
+            cerr << "Could not read completed request count" << endl;
+        }
+        SendGabrielResults();
+    }
+    if (poll_items[0].revents & ZMQ_POLLIN) {
+        ReceiveGabrielMessage();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::ReceiveGabrielMessage() {
+    zmq::message_t identity_msg;
+    zmq::message_t payload_msg;
+    socket.recv(&identity_msg);
+    if (!identity_msg.more()) {
+        return;
+    }
+    socket.recv(&payload_msg);
+    // Drain anything unexpected so the next message starts at an identity
+    while (payload_msg.more()) {
+        socket.recv(&payload_msg);
+    }
+
+    string identity(static_cast<const char *>(identity_msg.data()), identity_msg.size());
+    bool first_contact = gabriel_clients.find(identity) == gabriel_clients.end();
+    GabrielClient& client = gabriel_clients[identity];
+    client.last_seen_ns = monotonic_time_ns();
+    if (payload_msg.size() == 0 || first_contact) {
+        SendGabrielWelcome(identity);
+        if (payload_msg.size() == 0) {
+            return;
+        }
+    }
+
+    gabriel::FromClient from_client;
+    if (!from_client.ParseFromArray(payload_msg.data(), payload_msg.size())) {
+        cerr << "Could not parse Gabriel frame from client" << endl;
+        return;
+    }
+
+    ReplyRoute route;
+    route.identity = identity;
+    route.source_name = from_client.source_name();
+    route.gabriel_frame_id = from_client.frame_id();
+
+    if (find(gabriel_sources.begin(), gabriel_sources.end(), route.source_name) == gabriel_sources.end()) {
+        SendGabrielResponse(route, gabriel::ResultWrapper::NO_ENGINE_FOR_SOURCE, false, nullptr);
+        return;
+    }
+
+    // A client sending without a token has lost count, the token is not ours to return
+    int& tokens_in_use = client.tokens_in_use[route.source_name];
+    if (tokens_in_use >= gabriel_tokens) {
+        SendGabrielResponse(route, gabriel::ResultWrapper::NO_TOKENS, false, nullptr);
+        return;
+    }
+
+    size_t requests_in_flight;
+    {
+        lock_guard<mutex> lock(mtx);
+        requests_in_flight = pending_requests.size();
+    }
+    if (requests_in_flight >= GABRIEL_MAX_REQUESTS_IN_FLIGHT) {
+        SendGabrielResponse(route, gabriel::ResultWrapper::SERVER_DROPPED_FRAME, true, nullptr);
+        return;
+    }
+
+    gabriel::InputFrame* input_frame = from_client.mutable_input_frame();
+    ComputeRequest request;
+    if (input_frame->payloads_size() < 1 ||
+        (input_frame->has_extras() && !input_frame->extras().UnpackTo(&request))) {
+        SendGabrielResponse(route, gabriel::ResultWrapper::WRONG_INPUT_FORMAT, true, nullptr);
+        return;
+    }
+    // Frame sizes are checked in IngestRequest, once any tile delta is applied
+    request.mutable_frame_data()->swap(*input_frame->mutable_payloads(0));
+
+    if (capture) {
+        capture->Append(request.SerializeAsString(), identity, monotonic_time_ns());
+    }
+
+    tokens_in_use++;
+    IngestWireRequest(request, route, identity);
+}
+
+//-----------------------------------------------------------------------------
+
+// Identities are per connection, so without this every reconnect would leave
+// an entry behind
+void ComputeEngine::ExpireGabrielClients() {
+    int64_t now_ns = monotonic_time_ns();
+    for (auto it = gabriel_clients.begin(); it != gabriel_clients.end();) {
+        bool tokens_out = false;
+        for (const auto& source : it->second.tokens_in_use) {
+            tokens_out |= source.second > 0;
+        }
+        if (!tokens_out && now_ns - it->second.last_seen_ns > GABRIEL_CLIENT_IDLE_MS * 1000000LL) {
+            it = gabriel_clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::SendGabrielResults() {
+    deque<CompletedRequest> completed;
+    {
+        lock_guard<mutex> lock(mtx);
+        completed.swap(completed_requests);
+    }
+
+    for (const CompletedRequest& request : completed) {
+        auto client = gabriel_clients.find(request.route.identity);
+        if (client != gabriel_clients.end()) {
+            int& tokens_in_use = client->second.tokens_in_use[request.route.source_name];
+            if (tokens_in_use > 0) {
+                tokens_in_use--;
+            }
+        }
+        // The ComputeResult always goes back, its status says what was missed
+        int status = gabriel::ResultWrapper::SUCCESS;
+        if (request.status == ComputeResult::TIMED_OUT) {
+            status = gabriel::ResultWrapper::ENGINE_ERROR;
+        } else if (request.status == ComputeResult::STALE_FRAME) {
+            status = gabriel::ResultWrapper::SERVER_DROPPED_FRAME;
+        } else if (request.status == ComputeResult::NO_CAMERA) {
+            status = gabriel::ResultWrapper::NO_ENGINE_FOR_SOURCE;
+        } else if (request.status == ComputeResult::REFERENCE_MISSING ||
+                   request.status == ComputeResult::INVALID_FRAME) {
+            status = gabriel::ResultWrapper::WRONG_INPUT_FORMAT;
+        }
+        SendGabrielResponse(request.route, status, true, &request.serialized_result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::SendGabrielWelcome(const string& identity) {
+    gabriel::ToClient to_client;
+    gabriel::ToClient::Welcome* welcome = to_client.mutable_welcome();
+    for (const string& source : gabriel_sources) {
+        welcome->add_sources_consumed(source);
+    }
+    welcome->set_num_tokens_per_source(gabriel_tokens);
+
+    cout << "Welcoming Gabriel client with " << gabriel_tokens << " tokens per source" << endl;
+    s_sendmore(socket, identity);
+    s_send(socket, to_client.SerializeAsString());
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::SendGabrielResponse(const ReplyRoute& route, int status, bool return_token,
+                                        const string* serialized_result) {
+    gabriel::ToClient to_client;
+    gabriel::ToClient::Response* response = to_client.mutable_response();
+    response->set_source_name(route.source_name);
+    response->set_frame_id(route.gabriel_frame_id);
+    response->set_return_token(return_token);
+
+    gabriel::ResultWrapper* result_wrapper = response->mutable_result_wrapper();
+    result_wrapper->set_status(static_cast<gabriel::ResultWrapper::Status>(status));
+    result_wrapper->set_result_producer_name(GABRIEL_PRODUCER_NAME);
+    if (serialized_result) {
+        result_wrapper->mutable_extras()->set_type_url(GABRIEL_RESULT_TYPE_URL);
+        result_wrapper->mutable_extras()->set_value(*serialized_result);
+    }
+
+    s_sendmore(socket, route.identity);
+    s_send(socket, to_client.SerializeAsString());
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,97 @@
+#include "ingest_resize.h"
+
+#include "tensorflow/lite/model.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <iostream>
+
+//-----------------------------------------------------------------------------
+
+IngestResizer::~IngestResizer() {
+    for (auto& entry : maps) {
+        mcv_free_resize_map(&entry.second);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool IngestResizer::SetModelSize(int width, int height) {
+    // Any size works, the resized width is rounded to whole YUV422 macropixels
+    if (width <= 0 || height <= 0) {
+        cerr << "Unsupported model input size " << width << "x" << height << endl;
+        return false;
+    }
+    model_width = width;
+    model_height = height;
+    cout << "Resizing frames to model input " << width << "x" << height << " on ingest" << endl;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool IngestResizer::LoadModelSize(const string& model_path) {
+    unique_ptr<tflite::FlatBufferModel> model = tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
+    if (!model) {
+        cerr << "Could not load model " << model_path << endl;
+        return false;
+    }
+
+    // Only the flatbuffer is read, no interpreter is built
+    const tflite::SubGraph* subgraph = model->GetModel()->subgraphs()->Get(0);
+    const tflite::Tensor* input = subgraph->tensors()->Get(subgraph->inputs()->Get(0));
+    const auto* shape = input->shape();
+    if (!shape || shape->size() != 4) {
+        cerr << "Expected an NHWC input tensor in " << model_path << endl;
+        return false;
+    }
+    return SetModelSize(shape->Get(2), shape->Get(1));
+}
+
+//-----------------------------------------------------------------------------
+
+bool IngestResizer::ResizedSize(int width, int height, int& out_width, int& out_height) const {
+    if (model_width <= 0) {
+        return false;
+    }
+    // The side closest to the model input ends up matching it, the other stays larger
+    double scale = max((double)model_width / width, (double)model_height / height);
+    if (scale >= 1.0) {
+        return false;
+    }
+    // YUV422 output needs whole Y0 U Y1 V macropixels
+    out_width = ((int)ceil(width * scale) + 1) & ~1;
+    out_height = (int)ceil(height * scale);
+    return out_width <= width && out_height <= height && (out_width < width || out_height < height);
+}
+
+//-----------------------------------------------------------------------------
+
+const uint8_t* IngestResizer::Resize(const uint8_t* yuyv, int width, int height, int out_width,
+                                     int out_height) {
+    MapKey key(make_pair(width, height), make_pair(out_width, out_height));
+    auto it = maps.find(key);
+    if (it == maps.end()) {
+        if (maps.size() >= kMaxMaps) {
+            for (auto& entry : maps) {
+                mcv_free_resize_map(&entry.second);
+            }
+            maps.clear();
+        }
+
+        undistort_map_t resize_map;
+        if (mcv_init_resize_map(width, height, out_width, out_height, &resize_map)) {
+            return nullptr;
+        }
+        it = maps.emplace(key, resize_map).first;
+    }
+
+    output.resize((size_t)out_width * out_height * 2);
+    if (mcv_resize_yuv422_image(yuyv, output.data(), &it->second)) {
+        return nullptr;
+    }
+    return output.data();
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,44 @@
+#ifndef INGEST_RESIZE_H
+#define INGEST_RESIZE_H
+
+#include <resize.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Shrinks YUV422 frames towards the model's input size before they are written
+// to the onboardcompute pipe, so voxl-tflite-server never receives pixels its
+// own preprocessing would throw away. Frames are scaled uniformly and never
+// below the model input on either side, so the aspect ratio voxl-tflite-server
+// sees is the camera's. One resize map is kept per (input size, output size) pair.
+class IngestResizer {
+ public:
+    ~IngestResizer();
+
+    // Model geometry, either given directly or read from the .tflite input tensor
+    bool SetModelSize(int width, int height);
+    bool LoadModelSize(const string& model_path);
+
+    // Size a width x height frame is shrunk to, false if it would not get smaller
+    bool ResizedSize(int width, int height, int& out_width, int& out_height) const;
+
+    // Returns the frame resized to out_width x out_height (valid until the next
+    // call), or nullptr on error
+    const uint8_t* Resize(const uint8_t* yuyv, int width, int height, int out_width, int out_height);
+
+ private:
+    typedef pair<pair<int, int>, pair<int, int>> MapKey;
+    // ROI sizes drift while tracking, so the cache is flushed when it fills
+    static const size_t kMaxMaps = 16;
+
+    int model_width = 0;
+    int model_height = 0;
+    map<MapKey, undistort_map_t> maps;
+    vector<uint8_t> output;
+};
+
+#endif // INGEST_RESIZE_H
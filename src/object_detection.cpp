@@ -1,51 +1,149 @@
-#include <string>
+#include "object_detection.h"
+#include "detection_log.h"
 
-#include <ai_detection.h>
-#include <modal_pipe.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-using namespace std;
+#include <iostream>
 
-static const string kProcessName = "steeleagle-os-onboard-compute";
+//-----------------------------------------------------------------------------
 
-static void tflite_server_connect_cb(int ch, void *context)
-{
-    printf("Connected to tflite server\n");
+DetectionService::~DetectionService() {
+    Stop();
 }
 
-static void tflite_server_disconnect_cb(int ch, void *context)
-{
-    fprintf(stderr, "Disconnected from tflite server\n");
+//-----------------------------------------------------------------------------
+
+bool DetectionService::Start() {
+    if (region) {
+        cerr << "Detection snapshots already started" << endl;
+        return false;
+    }
+    int fd = shm_open(DETECTION_SNAPSHOT_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        cerr << "Could not create " << DETECTION_SNAPSHOT_SHM_NAME << ": " << strerror(errno) << endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(DetectionSnapshotRegion)) < 0) {
+        cerr << "Could not size " << DETECTION_SNAPSHOT_SHM_NAME << ": " << strerror(errno) << endl;
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, sizeof(DetectionSnapshotRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "Could not map " << DETECTION_SNAPSHOT_SHM_NAME << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    // A previous instance's region is reset; readers check the magic last
+    region = static_cast<DetectionSnapshotRegion *>(mapped);
+    region->magic = 0;
+    atomic_thread_fence(memory_order_release);
+    memset(static_cast<void *>(region), 0, sizeof(DetectionSnapshotRegion));
+    region->version = DETECTION_SNAPSHOT_VERSION;
+    atomic_thread_fence(memory_order_release);
+    region->magic = DETECTION_SNAPSHOT_MAGIC;
+
+    cout << "Publishing detection snapshots in " << DETECTION_SNAPSHOT_SHM_NAME << endl;
+    return true;
 }
 
-static void tflite_server_cb(int ch, char *data, int bytes, void *context)
-{
-    for (int off = 0; off + (int)sizeof(ai_detection_t) <= bytes; off += sizeof(ai_detection_t)) {
-        ai_detection_t *detection = reinterpret_cast<ai_detection_t *>(data + off);
-        printf("class confidence: %f\n", detection->class_confidence);
+//-----------------------------------------------------------------------------
+
+int DetectionService::FindCamera(const string& camera) {
+    uint32_t n = region->num_cameras.load(memory_order_acquire);
+    for (uint32_t i = 0; i < n; i++) {
+        if (strncmp(region->cameras[i].name, camera.c_str(), BUF_LEN) == 0) {
+            return i;
+        }
+    }
+
+    lock_guard<mutex> lock(add_camera_mtx);
+    n = region->num_cameras.load(memory_order_relaxed);
+    for (uint32_t i = 0; i < n; i++) {
+        if (strncmp(region->cameras[i].name, camera.c_str(), BUF_LEN) == 0) {
+            return i;
+        }
     }
+    if (n >= DETECTION_SNAPSHOT_MAX_CAMERAS) {
+        return -1;
+    }
+    strncpy(region->cameras[n].name, camera.c_str(), BUF_LEN - 1);
+    region->num_cameras.store(n + 1, memory_order_release);
+    return n;
 }
 
-int run_object_detection_loop()
-{
-    int ch = pipe_client_get_next_available_channel();
-    const string &input_pipe = "/run/mpa/tflite_data";
+//-----------------------------------------------------------------------------
 
-    main_running = 1;
+void DetectionService::Publish(const string& camera, uint64_t request_id, int64_t capture_time_ns,
+                               const DetectionBuffer& detections, const NameTable& names) {
+    if (!region) {
+        return;
+    }
+    int index = FindCamera(camera);
+    if (index < 0) {
+        return;
+    }
 
-    pipe_client_set_connect_cb(ch, tflite_server_connect_cb, nullptr);
-    pipe_client_set_disconnect_cb(ch, tflite_server_disconnect_cb, nullptr);
-    pipe_client_set_simple_helper_cb(ch, tflite_server_cb, nullptr);
+    DetectionSnapshotCamera& snapshots = region->cameras[index];
+    CameraWriter& writer = writers[index];
+    lock_guard<mutex> lock(writer.mtx);
+    uint64_t sequence = writer.sequence + 1;
+    DetectionSnapshotSlot& slot = snapshots.slots[sequence % DETECTION_SNAPSHOT_SLOTS];
 
-    if (pipe_client_open(ch, input_pipe.c_str(), kProcessName.c_str(), EN_PIPE_CLIENT_SIMPLE_HELPER, 10 * sizeof(ai_detection_t)))
-    {
-        fprintf(stderr, "Failed to open pipe: %s\n", input_pipe.c_str());
-        return -1;
+    // Readers that copy this slot from here on see a stale sequence and retry
+    slot.sequence.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.request_id = request_id;
+    slot.capture_time_ns = capture_time_ns;
+    slot.num_detections = 0;
+    slot.truncated = 0;
+    for (size_t i = 0; i < detections.Size(); i++) {
+        if (slot.num_detections == DETECTION_SNAPSHOT_MAX_DETECTIONS) {
+            slot.truncated = detections.Size() - i;
+            break;
+        }
+        ai_detection_t& detection = slot.detections[slot.num_detections++];
+        memset(&detection, 0, sizeof(detection));
+        detection.timestamp_ns = detections.timestamp_ns[i];
+        detection.frame_id = detections.frame_id[i];
+        detection.class_id = detections.class_id[i];
+        strncpy(detection.class_name, names.Name(detections.class_name[i]).c_str(), BUF_LEN - 1);
+        strncpy(detection.cam, names.Name(detections.cam[i]).c_str(), BUF_LEN - 1);
+        detection.class_confidence = detections.class_confidence[i];
+        detection.detection_confidence = detections.detection_confidence[i];
+        detection.x_min = detections.x_min[i];
+        detection.y_min = detections.y_min[i];
+        detection.x_max = detections.x_max[i];
+        detection.y_max = detections.y_max[i];
     }
 
-    while (main_running) {
-      usleep(5000000);
+    slot.publish_time_ns = monotonic_time_ns();
+    slot.sequence.store(sequence, memory_order_release);
+    snapshots.latest.store(sequence, memory_order_release);
+    writer.sequence = sequence;
+
+    // Pairs with the reader registering before it checks generation
+    region->generation.fetch_add(1);
+    if (region->waiters.load() > 0) {
+        detection_snapshot_futex(&region->generation, FUTEX_WAKE, INT_MAX, nullptr);
     }
+}
+
+//-----------------------------------------------------------------------------
 
-    return 0;
+void DetectionService::Stop() {
+    if (!region || stopped) {
+        return;
+    }
+    // New readers fail to open from here on, existing ones keep the last frames.
+    // The mapping stays: pipe helper threads may still be delivering until exit.
+    shm_unlink(DETECTION_SNAPSHOT_SHM_NAME);
+    stopped = true;
 }
+
+//-----------------------------------------------------------------------------
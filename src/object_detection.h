@@ -0,0 +1,46 @@
+#ifndef OBJECT_DETECTION_H
+#define OBJECT_DETECTION_H
+
+#include <detection_snapshot.h>
+
+#include "detection_buffer.h"
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// Resident publisher for the shared memory snapshots in detection_snapshot.h.
+// The engine hands it every client frame it answers, with the detections
+// already mapped back to full frame coordinates, and they are written straight
+// into the camera's next ring slot. Blocked readers are only woken when there
+// are any. Nothing runs between frames.
+class DetectionService {
+ public:
+    ~DetectionService();
+    bool Start();
+    // Results of one client frame from camera, before the client's filter.
+    // Safe to call from any thread.
+    void Publish(const string& camera, uint64_t request_id, int64_t capture_time_ns,
+                 const DetectionBuffer& detections, const NameTable& names);
+    void Stop();
+
+ private:
+    // Publisher side of one camera
+    struct CameraWriter {
+        mutex mtx;              // results finish on the socket, pipe and encoder threads
+        uint64_t sequence = 0;  // last sequence published
+    };
+
+    // Index of camera in the region, added the first time it is seen. -1 when full.
+    int FindCamera(const string& camera);
+
+    DetectionSnapshotRegion* region = nullptr;
+    bool stopped = false;
+    mutex add_camera_mtx;
+    CameraWriter writers[DETECTION_SNAPSHOT_MAX_CAMERAS];
+};
+
+#endif // OBJECT_DETECTION_H
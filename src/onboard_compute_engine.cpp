@@ -1,6 +1,11 @@
 #include <iostream>
 
 #include "onboard_compute_engine.h"
+#include "detection_log.h"
+#include "frame_capture.h"
+#include "ingest_resize.h"
+#include "object_detection.h"
+#include "result_encode.h"
 #include "zhelpers.hpp"
 #include "gabriel.pb.h"
 #include "onboard_compute.pb.h"
@@ -9,6 +14,14 @@
 #include <modal_pipe_server.h>
 #include <modal_start_stop.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <memory>
@@ -21,6 +34,13 @@
 #define PIPE_LOCATION (MODAL_PIPE_DEFAULT_BASE_DIR PIPE_NAME "/")
 #define TFLITE_PIPE_NAME "tflite_data"
 #define TFLITE_PIPE_LOCATION (MODAL_PIPE_DEFAULT_BASE_DIR TFLITE_PIPE_NAME "/")
+#define DENSE_PIPE_NAME "tflite_dense"
+#define GABRIEL_DEFAULT_SOURCE "onboard_compute"
+#define DEFAULT_DEADLINE_MS 2000
+#define MAX_CAMERAS 8
+#define MAX_CAMERA_NAME_LEN 16
+#define MAX_SPARE_RESULTS 32
+#define MAX_TOMBSTONES 8
 
 //-----------------------------------------------------------------------------
 
@@ -30,69 +50,170 @@ using namespace steeleagle;
 //-----------------------------------------------------------------------------
 
 unique_ptr<ComputeEngine> engine;
+unique_ptr<DetectionRecorder> recorder;
+unique_ptr<DetectionReplayer> replayer;
+unique_ptr<FrameCapture> capture;
+unique_ptr<IngestResizer> resizer;
+unique_ptr<DetectionService> detection_service;
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::AccumulateResults(int ch, const char* data, int bytes) {
+    CameraChannel* camera;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = cameras_by_channel.find(ch);
+        if (it == cameras_by_channel.end()) {
+            cerr << "Results on unknown channel " << ch << endl;
+            return;
+        }
+        camera = it->second;
+    }
+    AccumulateCameraResults(*camera, data, bytes);
+}
 
 //-----------------------------------------------------------------------------
 
-void ComputeEngine::AccumulateResults(vector<ai_detection_t>&& new_detections) {
-    // Check for delimiter frame
-    bool send_results = new_detections.back().frame_id == -1;
-    accumulated_results.insert(accumulated_results.end(),
-                               make_move_iterator(new_detections.begin()),
-                               make_move_iterator(new_detections.end()));
-    if (send_results) {
-        SendResult();
+void ComputeEngine::AccumulateCameraResults(CameraChannel& camera, const char* data, int bytes) {
+    // Each pipe helper thread unpacks into its own buffer, reused for every callback
+    static thread_local DetectionBuffer detections;
+    static thread_local vector<uint64_t> finished_requests;
+    detections.Clear();
+    detections.AppendPacked(data, bytes, names);
+    finished_requests.clear();
+
+    deque<int>& frame_order = camera.frame_order;
+    {
+        lock_guard<mutex> lock(mtx);
+        for (size_t i = 0; i < detections.Size(); i++) {
+            // Delimiters carry no frame_id; voxl-tflite-server answers frames in
+            // the order they were written, so one closes the oldest frame in flight
+            if (detections.frame_id[i] == -1) {
+                if (frame_order.empty()) {
+                    cerr << "Delimiter frame with no frame in flight" << endl;
+                    continue;
+                }
+                auto frame = frames_in_flight.find(frame_order.front());
+                frame_order.pop_front();
+                if (frame == frames_in_flight.end()) {
+                    continue;
+                }
+                auto request = pending_requests.find(frame->second.request_id);
+                frame->second.awaiting_delimiter = false;
+                if (!frame->second.awaiting_dense) {
+                    frames_in_flight.erase(frame);
+                }
+                if (request != pending_requests.end() && --request->second.frames_outstanding == 0) {
+                    finished_requests.push_back(request->first);
+                }
+                continue;
+            }
+
+            // Replayed logs carry foreign frame ids, credit those to the frame being processed
+            auto frame = frames_in_flight.find(detections.frame_id[i]);
+            if (frame == frames_in_flight.end() && replayer && !frame_order.empty()) {
+                frame = frames_in_flight.find(frame_order.front());
+            }
+            if (frame == frames_in_flight.end()) {
+                continue;
+            }
+            // Frames are answered in order, so tombstones written before this
+            // frame were dropped by voxl-tflite-server and won't be delimited
+            while (frame->second.awaiting_delimiter && !frame_order.empty() &&
+                   frame_order.front() != frame->first && IsTombstone(frame_order.front())) {
+                frames_in_flight.erase(frame_order.front());
+                frame_order.pop_front();
+            }
+            auto request = pending_requests.find(frame->second.request_id);
+            if (request == pending_requests.end()) {
+                continue;
+            }
+
+            // Map boxes from the cropped/resized frame back to full frame coordinates
+            const FrameRegion& region = frame->second.region;
+            detections.x_min[i] = detections.x_min[i] * region.scale_x + region.x;
+            detections.x_max[i] = detections.x_max[i] * region.scale_x + region.x;
+            detections.y_min[i] = detections.y_min[i] * region.scale_y + region.y;
+            detections.y_max[i] = detections.y_max[i] * region.scale_y + region.y;
+            if (camera.name_id) {
+                detections.cam[i] = camera.name_id;
+            }
+            request->second.results.AppendFrom(detections, i);
+        }
+    }
+
+    for (uint64_t request_id : finished_requests) {
+        SendResult(request_id);
     }
 }
 
 //-----------------------------------------------------------------------------
 
-void ComputeEngine::SendResult() {
+void ComputeEngine::SendResult(uint64_t request_id) {
+    PendingRequest request;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = pending_requests.find(request_id);
+        if (it == pending_requests.end()) {
+            return;
+        }
+        request = move(it->second);
+        pending_requests.erase(it);
+    }
+
+    // Local consumers get every detection of the frame, in full frame coordinates
+    if (detection_service && request.camera) {
+        detection_service->Publish(request.camera->name, request_id, request.capture_time_ns,
+                                   request.results, names);
+    }
+
     ComputeResult compute_result;
-    cout << "Sending " << accumulated_results.size() - 1 << " results to client" << endl;
-    for (const ai_detection_t& detection : accumulated_results) {
-        // Skip delimiter frame
-        if (detection.frame_id == -1)
-            continue;
-        cout << "Detection from frame " << detection.frame_id << endl;
-        AIDetection detection_proto;
-
-        string class_name(detection.class_name);
-        string cam(detection.cam);
-        cout << "Class name: " << class_name << "; cam: " << cam << endl;
-
-        // Set protobuf fields
-        detection_proto.set_timestamp_ns(detection.timestamp_ns);
-        detection_proto.set_class_id(detection.class_id);
-        detection_proto.set_frame_id(detection.frame_id);
-        detection_proto.set_class_name(class_name);
-        detection_proto.set_cam(cam);
-        detection_proto.set_class_confidence(detection.class_confidence);
-        detection_proto.set_detection_confidence(detection.detection_confidence);
-        detection_proto.set_x_min(detection.x_min);
-        detection_proto.set_y_min(detection.y_min);
-        detection_proto.set_x_max(detection.x_max);
-        detection_proto.set_y_max(detection.y_max);
-
-        *(compute_result.add_compute_result()) = detection_proto;
-    }
-    accumulated_results.clear();
-
-    // Send results to client
-    cout << "Sending result(s) to client" << endl;
-    string serialized_msg;
-    compute_result.SerializeToString(&serialized_msg);
-    s_send(socket, serialized_msg);
-
-    // Ready for next client request
+    compute_result.set_status(static_cast<ComputeResult::Status>(request.status));
+    // Drops anything the client filtered out. Results are sent from the socket
+    // thread, the pipe helper threads and the dense encoder, each keeps its own list.
+    static thread_local vector<uint32_t> kept_results;
+    request.filter.Apply(request.results, kept_results);
+    encode_detections(request.results, kept_results, names, compute_result, &cout);
+    for (const DenseMap& map : request.dense_maps) {
+        DenseOutput* dense = compute_result.add_dense_outputs();
+        RegionOfInterest* region = dense->mutable_region();
+        region->set_x(map.region_x);
+        region->set_y(map.region_y);
+        region->set_width(map.region_width);
+        region->set_height(map.region_height);
+        dense->set_width(map.width);
+        dense->set_height(map.height);
+        dense->set_encoding(static_cast<DenseOutput::Encoding>(map.encoding));
+        dense->set_data(map.data.data(), map.data.size());
+        for (int32_t class_id : map.palette) {
+            dense->add_palette(class_id);
+        }
+        dense->set_bits_per_index(map.bits_per_index);
+        dense->set_depth_scale(map.depth_scale);
+        dense->set_depth_offset(map.depth_offset);
+    }
+    cout << "Sending " << compute_result.compute_result_size() << " results to client" << endl;
+
+    // Hand the encoded result to whichever thread owns the client socket
+    CompletedRequest completed;
+    completed.request_id = request_id;
+    completed.route = move(request.route);
+    completed.status = request.status;
+    compute_result.SerializeToString(&completed.serialized_result);
     {
         lock_guard<mutex> lock(mtx);
-        ready = true;
+        completed_requests.push_back(move(completed));
+        if (spare_results.size() < MAX_SPARE_RESULTS) {
+            request.results.Clear();
+            spare_results.push_back(move(request.results));
+        }
     }
-    cv.notify_one();
-    // zmq::message_t reply(serialized_msg.size());
-    //memcpy(reply.data(), serialized_msg.data(), serialized_msg.size());
+    cv.notify_all();
 
-    //socket.send(reply);
+    uint64_t one = 1;
+    if (write(completion_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        cerr << "Could not signal completed request: " << strerror(errno) << endl;
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -100,11 +221,23 @@ void ComputeEngine::SendResult() {
 ComputeEngine::ComputeEngine(
     const string& address,
     int server_channel,
-    int client_channel) :
+    int client_channel,
+    int gabriel_tokens,
+    const vector<string>& gabriel_sources) :
+    default_deadline_ns(DEFAULT_DEADLINE_MS * 1000000LL),
     context(1),
-    socket(context, ZMQ_REP),
-    server_channel(server_channel),
-    client_channel(client_channel) {
+    socket(context, gabriel_tokens > 0 ? ZMQ_ROUTER : ZMQ_REP),
+    completion_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    gabriel_tokens(gabriel_tokens),
+    gabriel_sources(gabriel_sources) {
+
+    // The default camera's pipes are created up front by main
+    CameraChannel& camera = cameras[""];
+    camera.name_id = 0;
+    camera.server_channel = server_channel;
+    camera.client_channel = client_channel;
+    camera.dense_channel = -1;
+    cameras_by_channel[client_channel] = &camera;
 
     cout << "Binding on address " << address << endl;
     socket.bind(address);
@@ -112,6 +245,19 @@ ComputeEngine::ComputeEngine(
 
 //-----------------------------------------------------------------------------
 
+ComputeEngine::~ComputeEngine() {
+    dense_encoder.Stop();
+    close(completion_fd);
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::SetDefaultDeadline(int deadline_ms) {
+    default_deadline_ns = deadline_ms * 1000000LL;
+}
+
+//-----------------------------------------------------------------------------
+
 void ComputeEngine::HandleRequest() {
     cout << "\nWaiting for request from client" << endl;
     // Wait for next request from client
@@ -122,61 +268,637 @@ void ComputeEngine::HandleRequest() {
 
     zmq::poll(&poll_item, 1, -1);
 
-    string client_msg;
+    zmq::message_t client_msg;
     if (poll_item.revents & ZMQ_POLLIN) {
-        client_msg = s_recv(socket);
+        socket.recv(&client_msg);
     } else {
         cout << "Poller returned prematurely" << endl;
         return;
     }
 
     ComputeRequest request;
-    if (!request.ParseFromString(client_msg)) {
+    if (!request.ParseFromArray(client_msg.data(), client_msg.size())) {
         cerr << "Could not parse message from client" << endl;
     }
 
-    const string& frame_bytes = request.frame_data();
+    // The client library sends the frame as a second part, straight from
+    // its own buffer, instead of inside frame_data
+    if (client_msg.more()) {
+        zmq::message_t frame_msg;
+        socket.recv(&frame_msg);
+        request.mutable_frame_data()->assign(static_cast<const char *>(frame_msg.data()), frame_msg.size());
+        while (frame_msg.more()) {
+            socket.recv(&frame_msg);
+        }
+        if (capture) {
+            capture->Append(request.SerializeAsString(), "", monotonic_time_ns());
+        }
+    } else if (capture) {
+        capture->Append(string(static_cast<const char *>(client_msg.data()), client_msg.size()), "",
+                        monotonic_time_ns());
+    }
 
     cout << "Received frame from client successfully"<< endl;
 
-    camera_image_metadata_t cam_meta;
+    uint64_t request_id = IngestWireRequest(request, ReplyRoute(), "");
+
+    // Send results back before waiting for next request from client
+    string serialized_result;
+    if (WaitForResult(request_id, serialized_result)) {
+        cout << "Sending result(s) to client" << endl;
+        s_send(socket, serialized_result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+// Clips a requested region to the frame. YUV422 shares chroma between pixel
+// pairs, so crops are widened to start and end on a pair boundary. Regions
+// come from the client, so the far edges are summed in 64 bits.
+static bool clip_region(const RegionOfInterest& roi, int frame_width, int frame_height,
+                        FrameRegion& region) {
+    if (roi.width() < 0 || roi.height() < 0) {
+        return false;
+    }
+    int64_t x0 = max<int64_t>(0, roi.x()) & ~1;
+    int64_t y0 = max<int64_t>(0, roi.y());
+    int64_t x1 = min<int64_t>(frame_width, ((int64_t)roi.x() + roi.width() + 1) & ~1);
+    int64_t y1 = min<int64_t>(frame_height, (int64_t)roi.y() + roi.height());
+    if (x1 - x0 < 2 || y1 - y0 < 1) {
+        return false;
+    }
+    region = FrameRegion{(int)x0, (int)y0, (int)(x1 - x0), (int)(y1 - y0), 1.0f, 1.0f};
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t ComputeEngine::IngestRequest(const ComputeRequest& request, const ReplyRoute& route) {
+    const string& frame_bytes = request.frame_data();
+    int frame_width = request.frame_width();
+    int frame_height = request.frame_height();
+    // Cropping and resizing read width x height pixels, whatever the frontend
+    if (frame_width <= 0 || frame_height <= 0 ||
+        frame_bytes.size() != (size_t)frame_width * frame_height * 2) {
+        cerr << "Frame data does not match " << frame_width << "x" << frame_height << " YUV422" << endl;
+        return RejectRequest(route, ComputeResult::INVALID_FRAME);
+    }
+
+    vector<FrameRegion> regions;
+    for (const RegionOfInterest& roi : request.roi()) {
+        FrameRegion region;
+        if (clip_region(roi, frame_width, frame_height, region)) {
+            regions.push_back(region);
+        } else {
+            cerr << "Ignoring region of interest outside the frame" << endl;
+        }
+    }
+    if (regions.empty()) {
+        regions.push_back(FrameRegion{0, 0, frame_width, frame_height, 1.0f, 1.0f});
+    }
+
+    int64_t deadline_ns = monotonic_time_ns() +
+        (request.deadline_ms() > 0 ? request.deadline_ms() * 1000000LL : default_deadline_ns);
+    CameraChannel* camera = OpenCamera(request.camera());
+    if (!camera) {
+        return RejectRequest(route, ComputeResult::NO_CAMERA);
+    }
+    // Replayed detection logs have no dense maps to go with them
+    bool dense = request.dense_output() && !replayer && OpenDensePipe(*camera);
+    int outstanding_per_region = dense ? 2 : 1;
+
+    // Registered before any frame goes out so a fast reply can't be missed
+    uint64_t request_id = ++next_request_id;
+    {
+        lock_guard<mutex> lock(mtx);
+        PendingRequest& pending = pending_requests[request_id];
+        pending.route = route;
+        pending.camera = camera;
+        pending.capture_time_ns = request.capture_time_ns();
+        pending.deadline_ns = deadline_ns;
+        pending.status = ComputeResult::OK;
+        pending.frames_outstanding = regions.size() * outstanding_per_region;
+        pending.filter.Configure(request);
+        if (!spare_results.empty()) {
+            pending.results = move(spare_results.back());
+            spare_results.pop_back();
+        }
+        pending.dense_output = dense;
+        // The encoder clamps again to the map it gets, this bounds the client's value
+        pending.dense_downsample = max(1, min(request.dense_downsample(), min(frame_width, frame_height)));
+        pending.depth_bits = request.depth_bits();
+    }
+
+    for (FrameRegion& region : regions) {
+        // Checked per region, cropping and resizing the previous ones takes time
+        if (IsStale(request, deadline_ns)) {
+            DiscardRegion(request_id);
+            continue;
+        }
+        int region_frame_id = ++frame_id;
+
+        if (replayer) {
+            TrackFrame(region_frame_id, request_id, region, camera);
+            // Answer from the detection log instead of voxl-tflite-server
+            replayer->ReplayNextFrame([this, camera](const char* data, int bytes) {
+                AccumulateCameraResults(*camera, data, bytes);
+            });
+        } else {
+            WriteRegion(request_id, region_frame_id, camera, frame_bytes, frame_width, frame_height, region);
+        }
+    }
+    return request_id;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t ComputeEngine::IngestWireRequest(ComputeRequest& request, const ReplyRoute& route,
+                                          const string& sender_key) {
+    string key = sender_key + "/" + request.client_id() + "/" + request.camera();
+    if (!frame_references.Reconstruct(key, request)) {
+        return RejectRequest(route, ComputeResult::REFERENCE_MISSING);
+    }
+
+    uint64_t request_id = IngestRequest(request, route);
+    // Frames are copied into the pipe by now, the reference can be taken back
+    frame_references.Keep(key, request);
+    return request_id;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t ComputeEngine::RejectRequest(const ReplyRoute& route, int status) {
+    uint64_t request_id = ++next_request_id;
+    {
+        lock_guard<mutex> lock(mtx);
+        PendingRequest& pending = pending_requests[request_id];
+        pending.route = route;
+        pending.camera = nullptr;
+        pending.deadline_ns = monotonic_time_ns();
+        pending.status = status;
+        pending.frames_outstanding = 0;
+        pending.dense_output = false;
+    }
+    SendResult(request_id);
+    return request_id;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ComputeEngine::IsStale(const ComputeRequest& request, int64_t deadline_ns) const {
+    if (monotonic_time_ns() >= deadline_ns) {
+        return true;
+    }
+    if (request.max_age_ms() <= 0 || request.capture_time_ns() <= 0) {
+        return false;
+    }
+    int64_t now_ns = chrono::duration_cast<chrono::nanoseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    return now_ns - request.capture_time_ns() > request.max_age_ms() * 1000000LL;
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::DiscardRegion(uint64_t request_id) {
+    bool finished = false;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto request = pending_requests.find(request_id);
+        if (request == pending_requests.end()) {
+            return;
+        }
+        request->second.status = ComputeResult::STALE_FRAME;
+        request->second.frames_outstanding -= request->second.dense_output ? 2 : 1;
+        finished = request->second.frames_outstanding == 0;
+    }
+    cout << "Discarded stale frame region" << endl;
+    if (finished) {
+        SendResult(request_id);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool ComputeEngine::WaitForResult(uint64_t request_id, string& serialized_result) {
+    unique_lock<mutex> lock(mtx);
+    while (main_running) {
+        for (auto it = completed_requests.begin(); it != completed_requests.end(); ++it) {
+            if (it->request_id == request_id) {
+                serialized_result = move(it->serialized_result);
+                completed_requests.erase(it);
+                return true;
+            }
+        }
+
+        vector<uint64_t> expired;
+        int64_t wait_ns = CollectExpiredRequests(expired);
+        if (!expired.empty()) {
+            lock.unlock();
+            for (uint64_t id : expired) {
+                SendResult(id);
+            }
+            lock.lock();
+            continue;
+        }
+        cv.wait_for(lock, chrono::nanoseconds(min(wait_ns, (int64_t)1000000000)));
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+// Marks requests past their deadline TIMED_OUT, caller holds mtx. Frames
+// still waiting for a delimiter become tombstones, which keep their place in
+// frame_order so the late delimiter closes them and not the next frame.
+int64_t ComputeEngine::CollectExpiredRequests(vector<uint64_t>& expired) {
+    int64_t now_ns = monotonic_time_ns();
+    int64_t next_deadline_ns = INT64_MAX;
+    for (auto& request : pending_requests) {
+        if (request.second.deadline_ns > now_ns) {
+            next_deadline_ns = min(next_deadline_ns, request.second.deadline_ns);
+            continue;
+        }
+        if (request.second.status == ComputeResult::OK) {
+            request.second.status = ComputeResult::TIMED_OUT;
+        }
+        expired.push_back(request.first);
+    }
+    if (expired.empty()) {
+        return next_deadline_ns - now_ns;
+    }
+
+    for (auto frame = frames_in_flight.begin(); frame != frames_in_flight.end();) {
+        if (find(expired.begin(), expired.end(), frame->second.request_id) == expired.end()) {
+            ++frame;
+        } else if (frame->second.awaiting_delimiter) {
+            frame->second.request_id = 0;
+            frame->second.awaiting_dense = false;
+            ++frame;
+        } else {
+            frame = frames_in_flight.erase(frame);
+        }
+    }
+    for (auto& camera : cameras) {
+        TrimTombstones(camera.second.frame_order);
+    }
+    cerr << "Timed out " << expired.size() << " request(s)" << endl;
+    return next_deadline_ns - now_ns;
+}
+
+//-----------------------------------------------------------------------------
+
+// A frame of an expired request, or one no longer tracked. Caller holds mtx.
+bool ComputeEngine::IsTombstone(int region_frame_id) const {
+    auto frame = frames_in_flight.find(region_frame_id);
+    return frame == frames_in_flight.end() || frame->second.request_id == 0;
+}
+
+//-----------------------------------------------------------------------------
+
+// A frame voxl-tflite-server dropped is never delimited, and one that had no
+// detections is not noticed by the resync in AccumulateCameraResults either.
+// Only the newest tombstones are kept so those can't pile up. Caller holds mtx.
+void ComputeEngine::TrimTombstones(deque<int>& frame_order) {
+    size_t tombstones = 0;
+    for (int id : frame_order) {
+        tombstones += IsTombstone(id);
+    }
+    for (auto it = frame_order.begin(); tombstones > MAX_TOMBSTONES && it != frame_order.end();) {
+        if (IsTombstone(*it)) {
+            frames_in_flight.erase(*it);
+            it = frame_order.erase(it);
+            tombstones--;
+        } else {
+            ++it;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+int64_t ComputeEngine::ExpireRequests() {
+    vector<uint64_t> expired;
+    int64_t wait_ns;
+    {
+        lock_guard<mutex> lock(mtx);
+        wait_ns = CollectExpiredRequests(expired);
+    }
+    for (uint64_t request_id : expired) {
+        SendResult(request_id);
+    }
+    return wait_ns;
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::TrackFrame(int region_frame_id, uint64_t request_id, const FrameRegion& region,
+                               CameraChannel* camera) {
+    lock_guard<mutex> lock(mtx);
+    auto request = pending_requests.find(request_id);
+    bool dense = request != pending_requests.end() && request->second.dense_output;
+    frames_in_flight[region_frame_id] = InFlightFrame{request_id, region, camera, true, dense};
+    camera->frame_order.push_back(region_frame_id);
+}
+
+//-----------------------------------------------------------------------------
+
+// Camera names end up in pipe paths, keep them to a short safe alphabet
+static bool valid_camera_name(const string& name) {
+    if (name.size() > MAX_CAMERA_NAME_LEN) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+CameraChannel* ComputeEngine::OpenCamera(const string& name) {
+    auto it = cameras.find(name);
+    if (it != cameras.end()) {
+        return &it->second;
+    }
+    if (!valid_camera_name(name) || cameras.size() >= MAX_CAMERAS) {
+        cerr << "Refusing to open camera " << name << endl;
+        return nullptr;
+    }
+
+    CameraChannel camera;
+    camera.name = name;
+    camera.name_id = names.Intern(name);
+    camera.server_channel = -1;
+    camera.client_channel = -1;
+    camera.dense_channel = -1;
+    // Detection replay answers every camera itself, there is nothing to connect to
+    if (!replayer) {
+        camera.server_channel = pipe_server_get_next_available_channel();
+        if (create_server_pipe(camera.server_channel, PIPE_NAME "_" + name)) {
+            cerr << "Failed to create server pipe for camera " << name << endl;
+            return nullptr;
+        }
+        camera.client_channel = pipe_client_get_next_available_channel();
+    }
+
+    CameraChannel* opened;
+    {
+        lock_guard<mutex> lock(mtx);
+        opened = &cameras.emplace(name, move(camera)).first->second;
+        if (opened->client_channel >= 0) {
+            cameras_by_channel[opened->client_channel] = opened;
+        }
+    }
+
+    // Results may arrive as soon as the pipe opens, so the camera is registered first
+    if (opened->client_channel >= 0) {
+        pipe_client_set_simple_helper_cb(opened->client_channel, tflite_server_cb, nullptr);
+        if (create_client_pipe(opened->client_channel, TFLITE_PIPE_NAME "_" + name)) {
+            cerr << "Failed to open result pipe for camera " << name << endl;
+        }
+    }
+    cout << "Opened camera " << name << endl;
+    return opened;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ComputeEngine::OpenDensePipe(CameraChannel& camera) {
+    if (camera.dense_channel >= 0) {
+        return true;
+    }
+
+    if (!dense_encoder.Running()) {
+        dense_encoder.Start([this](uint64_t request_id, DenseMap&& map) {
+            FinishDenseMap(request_id, move(map));
+        });
+    }
+
+    int ch = pipe_client_get_next_available_channel();
+    {
+        lock_guard<mutex> lock(mtx);
+        camera.dense_channel = ch;
+        cameras_by_channel[ch] = &camera;
+    }
+    pipe_client_set_camera_helper_cb(ch, dense_server_cb, nullptr);
+
+    string pipe_name = camera.name.empty() ? DENSE_PIPE_NAME : DENSE_PIPE_NAME "_" + camera.name;
+    string location = MODAL_PIPE_DEFAULT_BASE_DIR + pipe_name + "/";
+    int ret = pipe_client_open(ch, location.c_str(), PROCESS_NAME, CLIENT_FLAG_EN_CAMERA_HELPER, 0);
+    if (ret) {
+        pipe_print_error(ret);
+        cerr << "Failed to open dense output pipe " << pipe_name << endl;
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::AccumulateDenseOutput(int ch, const camera_image_metadata_t& meta, const char *frame) {
+    uint64_t request_id;
+    DenseMap region;
+    int downsample;
+    int depth_bits;
+    {
+        lock_guard<mutex> lock(mtx);
+        // voxl-tflite-server keeps the input frame_id on its output frames
+        auto in_flight = frames_in_flight.find(meta.frame_id);
+        if (in_flight == frames_in_flight.end() || !in_flight->second.awaiting_dense) {
+            return;
+        }
+        request_id = in_flight->second.request_id;
+        const FrameRegion& frame_region = in_flight->second.region;
+        region.region_x = frame_region.x;
+        region.region_y = frame_region.y;
+        region.region_width = frame_region.width;
+        region.region_height = frame_region.height;
+
+        in_flight->second.awaiting_dense = false;
+        if (!in_flight->second.awaiting_delimiter) {
+            frames_in_flight.erase(in_flight);
+        }
+
+        auto request = pending_requests.find(request_id);
+        if (request == pending_requests.end()) {
+            return;
+        }
+        downsample = request->second.dense_downsample;
+        depth_bits = request->second.depth_bits;
+    }
+
+    // A full queue only costs this map, the request still completes
+    if (!dense_encoder.Submit(request_id, region, meta, frame, downsample, depth_bits)) {
+        cerr << "Dense encoder busy, dropping map for frame " << meta.frame_id << endl;
+        region.data.clear();
+        FinishDenseMap(request_id, move(region));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::FinishDenseMap(uint64_t request_id, DenseMap&& map) {
+    bool finished;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto request = pending_requests.find(request_id);
+        if (request == pending_requests.end()) {
+            return;
+        }
+        if (!map.data.empty()) {
+            request->second.dense_maps.push_back(move(map));
+        }
+        finished = --request->second.frames_outstanding == 0;
+    }
+    if (finished) {
+        SendResult(request_id);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::WriteRegion(uint64_t request_id, int region_frame_id, CameraChannel* camera,
+                                const string& frame_bytes, int frame_width, int frame_height,
+                                FrameRegion& region) {
+    const uint8_t* frame = reinterpret_cast<const uint8_t *>(frame_bytes.data());
+    const uint8_t* region_data = frame;
+    size_t region_bytes = frame_bytes.size();
+
+    if (region.width != frame_width || region.height != frame_height) {
+        size_t pixel_bytes = 2;
+        size_t row_bytes = (size_t)frame_width * pixel_bytes;
+        size_t region_row_bytes = region.width * pixel_bytes;
+        region_bytes = region_row_bytes * region.height;
+
+        if (region.width == frame_width) {
+            // Full width bands are contiguous, send straight from the request
+            region_data = frame + region.y * row_bytes;
+        } else {
+            crop_buffer.resize(region_bytes);
+            const uint8_t* src = frame + region.y * row_bytes + region.x * pixel_bytes;
+            for (int row = 0; row < region.height; row++) {
+                memcpy(crop_buffer.data() + row * region_row_bytes, src + row * row_bytes, region_row_bytes);
+            }
+            region_data = crop_buffer.data();
+        }
+    }
+
+    // Only ship the pixels the model will actually look at
+    int sent_width = region.width;
+    int sent_height = region.height;
+    int resized_width;
+    int resized_height;
+    if (resizer && resizer->ResizedSize(region.width, region.height, resized_width, resized_height)) {
+        const uint8_t* resized = resizer->Resize(region_data, region.width, region.height,
+                                                 resized_width, resized_height);
+        if (resized) {
+            sent_width = resized_width;
+            sent_height = resized_height;
+            region_data = resized;
+            region_bytes = sent_width * sent_height * 2;
+        }
+    }
+    region.scale_x = (float)region.width / sent_width;
+    region.scale_y = (float)region.height / sent_height;
+    TrackFrame(region_frame_id, request_id, region, camera);
+
+    camera_image_metadata_t cam_meta = {};
     cam_meta.magic_number = CAMERA_MAGIC_NUMBER;
-    cam_meta.frame_id = ++frame_id;
-    cam_meta.width = request.frame_width();
-    cam_meta.height = request.frame_height();
-    cam_meta.size_bytes = frame_bytes.size();
+    cam_meta.timestamp_ns = monotonic_time_ns();
+    cam_meta.frame_id = region_frame_id;
+    cam_meta.width = sent_width;
+    cam_meta.height = sent_height;
+    cam_meta.size_bytes = region_bytes;
     cam_meta.format = IMAGE_FORMAT_YUV422;
 
     // pipe_server_write(server_channel, &cam_meta,
     //                   sizeof(camera_image_metadata_t));
     // pipe_server_write(server_channel, frame_bytes.data(), frame_bytes.size());
-    if (pipe_server_write_camera_frame(server_channel, cam_meta, frame_bytes.data())) {
+    if (pipe_server_write_camera_frame(camera->server_channel, cam_meta, region_data)) {
         cerr << "Error writing camera frame to server pipe" << endl;
     }
 
     cout << "Sent frame to voxl-tflite-server" << endl;
+}
 
-    // Send results back before waiting for next request from client
-    unique_lock<mutex> lock(mtx);
-    ready = false;
+//-----------------------------------------------------------------------------
+
+void ComputeEngine::ReplayFrames(FrameCaptureReader& reader, bool realtime) {
+    vector<int64_t> latencies_ns;
+    int64_t wall_start_ns = monotonic_time_ns();
+    int64_t capture_start_ns = 0;
+    int64_t arrival_time_ns;
+    string sender_key;
+    string serialized_request;
+    bool first = true;
+
+    while (main_running && reader.Next(arrival_time_ns, sender_key, serialized_request)) {
+        if (first) {
+            capture_start_ns = arrival_time_ns;
+            first = false;
+        }
+
+        // In realtime the clock starts when the frame was due, so time spent
+        // queued behind a slow frame counts towards its latency
+        int64_t start_ns = monotonic_time_ns();
+        if (realtime) {
+            int64_t scheduled_ns = wall_start_ns + arrival_time_ns - capture_start_ns;
+            if (scheduled_ns > start_ns) {
+                this_thread::sleep_for(chrono::nanoseconds(scheduled_ns - start_ns));
+            }
+            start_ns = scheduled_ns;
+        }
+
+        ComputeRequest request;
+        if (!request.ParseFromString(serialized_request)) {
+            cerr << "Could not parse captured frame " << latencies_ns.size() << endl;
+            continue;
+        }
+
+        // Nobody is waiting on the socket, the result is only timed
+        string serialized_result;
+        if (!WaitForResult(IngestWireRequest(request, ReplyRoute(), sender_key), serialized_result)) {
+            break;
+        }
+        latencies_ns.push_back(monotonic_time_ns() - start_ns);
+    }
+
+    if (latencies_ns.empty()) {
+        cout << "No frames replayed" << endl;
+        return;
+    }
 
-    while (!cv.wait_for(lock, chrono::seconds(1), [&] { return ready || !main_running; }));
+    double elapsed_s = (monotonic_time_ns() - wall_start_ns) / 1e9;
+    size_t n = latencies_ns.size();
+    sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile_ms = [&](double p) {
+        return latencies_ns[min(n - 1, (size_t)(p * n))] / 1e6;
+    };
+
+    cout << "Replayed " << n << " frames in " << elapsed_s << " s ("
+         << n / elapsed_s << " fps)" << endl;
+    cout << "Latency ms: p50 " << percentile_ms(0.50) << ", p90 " << percentile_ms(0.90)
+         << ", p99 " << percentile_ms(0.99) << ", max " << latencies_ns.back() / 1e6 << endl;
 }
 
 //-----------------------------------------------------------------------------
 
 static void tflite_server_cb(int ch, char *data, int bytes, void *context) {
     cout << "Received results from voxl-tflite-server" << endl;
-    vector<ai_detection_t> detections;
-
-    for (int off = 0; off + (int)sizeof(ai_detection_t) <= bytes;
-            off += sizeof(ai_detection_t)) {
-        ai_detection_t *detection =
-            reinterpret_cast<ai_detection_t *>(data + off);
-        printf("Class confidence: %f\n", detection->class_confidence);
-        detections.push_back(*detection);
+    if (recorder) {
+        // Called from every camera's pipe helper thread, Append never blocks
+        recorder->Append(data, bytes);
     }
-    engine->AccumulateResults(move(detections));
+    // Unpacked straight out of the pipe's buffer, nothing is allocated per frame
+    engine->AccumulateResults(ch, data, bytes);
+}
+
+//-----------------------------------------------------------------------------
+
+static void dense_server_cb(int ch, camera_image_metadata_t meta, char *frame, void *context) {
+    engine->AccumulateDenseOutput(ch, meta, frame);
 }
 
 //-----------------------------------------------------------------------------
@@ -190,6 +912,62 @@ int main(int argc, char *argv[]) {
     string host(argv[1]);
     string port(argv[2]);
 
+    string record_path;
+    string replay_path;
+    string capture_path;
+    string replay_frames_path;
+    string model_path;
+    int model_width = 0;
+    int model_height = 0;
+    int gabriel_tokens = 0;
+    int deadline_ms = DEFAULT_DEADLINE_MS;
+    vector<string> gabriel_sources;
+    bool capture_compress = false;
+    bool replay_realtime = true;
+    bool detection_snapshot = false;
+    for (int i = 3; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--record-detections" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (arg == "--replay-detections" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--capture-frames" && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (arg == "--capture-compress") {
+            capture_compress = true;
+        } else if (arg == "--replay-frames" && i + 1 < argc) {
+            replay_frames_path = argv[++i];
+        } else if (arg == "--model" && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (arg == "--model-size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &model_width, &model_height) != 2) {
+                cerr << "Expected --model-size WIDTHxHEIGHT\n";
+                return -1;
+            }
+        } else if (arg == "--gabriel-tokens" && i + 1 < argc) {
+            gabriel_tokens = atoi(argv[++i]);
+        } else if (arg == "--gabriel-source" && i + 1 < argc) {
+            gabriel_sources.push_back(argv[++i]);
+        } else if (arg == "--deadline-ms" && i + 1 < argc) {
+            const char* value = argv[++i];
+            char* end;
+            errno = 0;
+            long parsed = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || errno == ERANGE || parsed <= 0 || parsed > INT_MAX) {
+                cerr << "Expected --deadline-ms MILLISECONDS greater than 0\n";
+                return -1;
+            }
+            deadline_ms = parsed;
+        } else if (arg == "--replay-max-speed") {
+            replay_realtime = false;
+        } else if (arg == "--detection-snapshot") {
+            detection_snapshot = true;
+        } else {
+            cerr << "Unknown argument " << arg << "\n";
+            return -1;
+        }
+    }
+
     ostringstream oss;
     oss << "tcp://*" << ":" << port;
 
@@ -204,31 +982,98 @@ int main(int argc, char *argv[]) {
     }
     make_pid_file(PROCESS_NAME);
 
+    // Up before any result pipe opens so the first frame is published
+    if (detection_snapshot) {
+        detection_service = make_unique<DetectionService>();
+        if (!detection_service->Start()) {
+            return -1;
+        }
+    }
+
     int server_ch = pipe_client_get_next_available_channel();
     int client_ch = pipe_client_get_next_available_channel();
 
-    engine = make_unique<ComputeEngine>(oss.str(), server_ch, client_ch);
-    pipe_client_set_simple_helper_cb(client_ch, tflite_server_cb, nullptr);
+    if (gabriel_tokens > 0 && gabriel_sources.empty()) {
+        gabriel_sources.push_back(GABRIEL_DEFAULT_SOURCE);
+    }
+    engine = make_unique<ComputeEngine>(oss.str(), server_ch, client_ch,
+                                        gabriel_tokens, gabriel_sources);
+    engine->SetDefaultDeadline(deadline_ms);
 
-    if (create_server_pipe(server_ch)) {
-        cerr << "Failed to create server pipe" << endl;
-        return -1;
+    if (!replay_path.empty()) {
+        // Replay stands in for voxl-tflite-server, so no pipes are needed
+        replayer = make_unique<DetectionReplayer>();
+        if (!replayer->Open(replay_path, replay_realtime)) {
+            return -1;
+        }
+    } else {
+        if (!record_path.empty()) {
+            recorder = make_unique<DetectionRecorder>();
+            if (!recorder->Start(record_path)) {
+                return -1;
+            }
+        }
+
+        pipe_client_set_simple_helper_cb(client_ch, tflite_server_cb, nullptr);
+
+        if (create_server_pipe(server_ch, PIPE_NAME)) {
+            cerr << "Failed to create server pipe" << endl;
+            return -1;
+        }
+
+        if (create_client_pipe(client_ch, TFLITE_PIPE_NAME)) {
+            cerr << "Failed to create client pipe" << endl;
+            return -1;
+        }
     }
 
-    if (create_client_pipe(client_ch)) {
-        cerr << "Failed to create client pipe" << endl;
-        return -1;
+    // Learn the model input geometry once so frames can be shrunk before the pipe
+    if (model_width > 0 || !model_path.empty()) {
+        resizer = make_unique<IngestResizer>();
+        bool ok = model_width > 0 ? resizer->SetModelSize(model_width, model_height)
+                                  : resizer->LoadModelSize(model_path);
+        if (!ok) {
+            return -1;
+        }
+    }
+
+    if (!capture_path.empty()) {
+        capture = make_unique<FrameCapture>();
+        if (!capture->Start(capture_path, capture_compress)) {
+            return -1;
+        }
     }
 
     main_running = 1;
 
-    while (main_running) {
-        engine->HandleRequest();
+    if (!replay_frames_path.empty()) {
+        // Drive the ingest path from a capture instead of a client
+        FrameCaptureReader reader;
+        if (reader.Open(replay_frames_path)) {
+            engine->ReplayFrames(reader, replay_realtime);
+        }
+    } else if (gabriel_tokens > 0) {
+        while (main_running) {
+            engine->HandleGabrielMessages();
+        }
+    } else {
+        while (main_running) {
+            engine->HandleRequest();
+        }
     }
 
     printf("Starting shutdown sequence\n");
     pipe_client_flush(client_ch);
     pipe_server_close_all();
+    if (recorder) {
+        recorder->Stop();
+    }
+    if (capture) {
+        capture->Stop();
+    }
+    if (detection_service) {
+        detection_service->Stop();
+    }
     remove_pid_file(PROCESS_NAME);
     printf("exiting cleanly\n");
     return 0;
@@ -236,11 +1081,14 @@ int main(int argc, char *argv[]) {
 
 //-----------------------------------------------------------------------------
 
-static int create_server_pipe(int ch) {
+static int create_server_pipe(int ch, const string& pipe_name) {
     pipe_info_t info = {
-        PIPE_NAME, PIPE_LOCATION, "camera", PROCESS_NAME,
+        "", "", "camera", PROCESS_NAME,
         16 * MODAL_PIPE_DEFAULT_PIPE_SIZE, 0
     };
+    string location = MODAL_PIPE_DEFAULT_BASE_DIR + pipe_name + "/";
+    snprintf(info.name, sizeof(info.name), "%s", pipe_name.c_str());
+    snprintf(info.location, sizeof(info.location), "%s", location.c_str());
 
     if (pipe_server_create(ch, info, 0)) {
         return -1;
@@ -250,8 +1098,9 @@ static int create_server_pipe(int ch) {
 
 //-----------------------------------------------------------------------------
 
-static int create_client_pipe(int ch) {
-    int ret = pipe_client_open(ch, TFLITE_PIPE_LOCATION, PROCESS_NAME,
+static int create_client_pipe(int ch, const string& pipe_name) {
+    string location = MODAL_PIPE_DEFAULT_BASE_DIR + pipe_name + "/";
+    int ret = pipe_client_open(ch, location.c_str(), PROCESS_NAME,
                                CLIENT_FLAG_EN_SIMPLE_HELPER,
                                10 * sizeof(ai_detection_t));
     if (ret) {
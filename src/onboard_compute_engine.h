@@ -1,32 +1,188 @@
 #include <ai_detection.h>
 
 #include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "dense_encode.h"
+#include "detection_buffer.h"
+#include "frame_delta.h"
+#include "result_filter.h"
 #include "zmq.hpp"
 
 using namespace std;
 
-static int create_server_pipe(int ch);
-static int create_client_pipe(int ch);
+namespace steeleagle {
+class ComputeRequest;
+}
+class FrameCaptureReader;
+
+static int create_server_pipe(int ch, const string& pipe_name);
+static int create_client_pipe(int ch, const string& pipe_name);
+static void tflite_server_cb(int ch, char *data, int bytes, void *context);
+static void dense_server_cb(int ch, camera_image_metadata_t meta, char *frame, void *context);
+
+// Part of a client frame sent to voxl-tflite-server as its own frame
+struct FrameRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+    float scale_x;  // region pixels per pixel sent, > 1 when resized on ingest
+    float scale_y;
+};
+
+// Where a finished result has to go. Empty for REP clients and replays.
+struct ReplyRoute {
+    string identity;            // ROUTER identity of a Gabriel client
+    string source_name;         // Gabriel source the frame came from
+    int64_t gabriel_frame_id;
+};
+
+// One camera's path through voxl-tflite-server: the pipe frames are written
+// to and the tflite_data style pipe its detections come back on. Each camera
+// has its own voxl-tflite-server instance and pipe helper thread. Requests for
+// different cameras are only in flight together on the Gabriel frontend; the
+// REP frontend waits for each result before it reads the next request.
+struct CameraChannel {
+    string name;                // empty for the default camera
+    uint16_t name_id;           // name in the engine's NameTable, 0 for the default camera
+    int server_channel;
+    int client_channel;
+    int dense_channel;          // -1 until a request asks for dense output
+    // Delimiter frames carry no frame_id, so this remembers the order frames
+    // were written to this camera's pipe in
+    deque<int> frame_order;
+};
+
+// A pipe frame voxl-tflite-server has not answered yet
+struct InFlightFrame {
+    uint64_t request_id;        // 0 once the request expired, the frame only waits for its delimiter
+    FrameRegion region;
+    CameraChannel* camera;
+    bool awaiting_delimiter;
+    bool awaiting_dense;        // the region's mask or depth map hasn't arrived
+};
+
+// A client request with at least one region still being processed
+struct PendingRequest {
+    ReplyRoute route;
+    CameraChannel* camera;      // nullptr if rejected before any frame was written
+    int64_t capture_time_ns;    // from the request, 0 if the client didn't set it
+    int64_t deadline_ns;        // CLOCK_MONOTONIC time a reply is due
+    int status;                 // ComputeResult::Status
+    int frames_outstanding;     // delimiters plus dense maps still to come
+    ResultFilter filter;
+    DetectionBuffer results;
+    bool dense_output;
+    int dense_downsample;
+    int depth_bits;
+    vector<DenseMap> dense_maps;
+};
+
+struct CompletedRequest {
+    uint64_t request_id;
+    ReplyRoute route;
+    int status;                 // ComputeResult::Status
+    string serialized_result;
+};
+
+// Credits handed out to one Gabriel client, per source
+struct GabrielClient {
+    map<string, int> tokens_in_use;
+    int64_t last_seen_ns;       // CLOCK_MONOTONIC time of its last message
+};
 
 class ComputeEngine {
  public:
-    ComputeEngine(const string& address, int server_channel, int client_channel);
+    // gabriel_tokens > 0 speaks the Gabriel protocol on a ROUTER socket
+    // instead of ComputeRequest/ComputeResult over REP
+    ComputeEngine(const string& address, int server_channel, int client_channel,
+                  int gabriel_tokens = 0, const vector<string>& gabriel_sources = vector<string>());
+    ~ComputeEngine();
+    // Reply deadline for requests that don't set their own
+    void SetDefaultDeadline(int deadline_ms);
     void HandleRequest();
+    void HandleGabrielMessages();
+    uint64_t IngestRequest(const steeleagle::ComputeRequest& request, const ReplyRoute& route);
+    // IngestRequest for requests off the wire, which may be tile deltas.
+    // sender_key identifies the connection when the transport knows it.
+    uint64_t IngestWireRequest(steeleagle::ComputeRequest& request, const ReplyRoute& route,
+                               const string& sender_key);
+    bool WaitForResult(uint64_t request_id, string& serialized_result);
+    void ReplayFrames(FrameCaptureReader& reader, bool realtime);
     void TfliteServerCb(int ch, char *data, int bytes, void *context);
-    void SendResult();
-    void AccumulateResults(vector<ai_detection_t>&& new_detections);
+    void SendResult(uint64_t request_id);
+    // Replies TIMED_OUT to every request past its deadline. Returns the time
+    // in ns until the next deadline.
+    int64_t ExpireRequests();
+    // Packed ai_detection_t records from the result pipe on client channel ch
+    void AccumulateResults(int ch, const char* data, int bytes);
+    // A segmentation mask or depth map from the dense pipe on client channel ch
+    void AccumulateDenseOutput(int ch, const camera_image_metadata_t& meta, const char *frame);
 
  private:
+    // Finds a camera, creating its pipes the first time it is asked for
+    CameraChannel* OpenCamera(const string& name);
+    void AccumulateCameraResults(CameraChannel& camera, const char* data, int bytes);
+    bool OpenDensePipe(CameraChannel& camera);
+    void FinishDenseMap(uint64_t request_id, DenseMap&& map);
+    void TrackFrame(int region_frame_id, uint64_t request_id, const FrameRegion& region,
+                    CameraChannel* camera);
+    // Answers a request straight away with status and no results
+    uint64_t RejectRequest(const ReplyRoute& route, int status);
+    bool IsStale(const steeleagle::ComputeRequest& request, int64_t deadline_ns) const;
+    void DiscardRegion(uint64_t request_id);
+    int64_t CollectExpiredRequests(vector<uint64_t>& expired);
+    bool IsTombstone(int region_frame_id) const;
+    void TrimTombstones(deque<int>& frame_order);
+    void WriteRegion(uint64_t request_id, int region_frame_id, CameraChannel* camera,
+                     const string& frame_bytes, int frame_width, int frame_height, FrameRegion& region);
+
+    // Gabriel protocol, see gabriel_frontend.cpp
+    void ReceiveGabrielMessage();
+    void ExpireGabrielClients();
+    void SendGabrielResults();
+    void SendGabrielWelcome(const string& identity);
+    void SendGabrielResponse(const ReplyRoute& route, int status, bool return_token,
+                             const string* serialized_result);
+
     int frame_id = 0;
+    uint64_t next_request_id = 0;
+    int64_t default_deadline_ns;
     zmq::context_t context;
     zmq::socket_t socket;
-    int server_channel;
-    int client_channel;
     mutex mtx;
     condition_variable cv;
-    bool ready;
-    vector<ai_detection_t> accumulated_results;
+    // Signalled with every completed request so a poll loop can wake on it
+    int completion_fd;
+
+    // Cameras are only added, so pointers into the map stay valid
+    map<string, CameraChannel> cameras;
+    unordered_map<int, CameraChannel*> cameras_by_channel;
+
+    // Requests in flight, frame ids are unique across cameras
+    unordered_map<uint64_t, PendingRequest> pending_requests;
+    unordered_map<int, InFlightFrame> frames_in_flight;
+    deque<CompletedRequest> completed_requests;
+    // Result buffers of answered requests, handed to new ones
+    vector<DetectionBuffer> spare_results;
+
+    // Class and camera names of every detection
+    NameTable names;
+
+    // Only touched by the thread that owns the socket
+    FrameReferences frame_references;
+    vector<uint8_t> crop_buffer;
+
+    int gabriel_tokens;
+    vector<string> gabriel_sources;
+    unordered_map<string, GabrielClient> gabriel_clients;
+
+    // Last so its worker stops before anything it calls back into goes away
+    DenseEncoder dense_encoder;
 };
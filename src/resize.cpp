@@ -0,0 +1,135 @@
+#include "resize.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------------------
+
+int mcv_init_resize_map(int w_in, int h_in, int w_out, int h_out, undistort_map_t* map) {
+    if (w_in < 2 || h_in < 2 || w_out < 1 || h_out < 1 || w_in > INT16_MAX || h_in > INT16_MAX) {
+        fprintf(stderr, "ERROR: invalid resize %dx%d -> %dx%d\n", w_in, h_in, w_out, h_out);
+        return -1;
+    }
+
+    map->L = (bilinear_lookup_t*)malloc(sizeof(bilinear_lookup_t) * w_out * h_out);
+    if (map->L == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate resize map\n");
+        return -1;
+    }
+    map->w_in = w_in;
+    map->h_in = h_in;
+    map->w_out = w_out;
+    map->h_out = h_out;
+
+    float x_scale = (float)w_in / (float)w_out;
+    float y_scale = (float)h_in / (float)h_out;
+
+    for (int v = 0; v < h_out; v++) {
+        // sample at pixel centers, clamped so the 2x2 square never leaves the image
+        float y_f = fminf(fmaxf((v + 0.5f) * y_scale - 0.5f, 0.0f), (float)(h_in - 1));
+        int y_i = (int)y_f;
+        if (y_i > h_in - 2) y_i = h_in - 2;
+        float y_r = y_f - y_i;
+
+        for (int u = 0; u < w_out; u++) {
+            float x_f = fminf(fmaxf((u + 0.5f) * x_scale - 0.5f, 0.0f), (float)(w_in - 1));
+            int x_i = (int)x_f;
+            if (x_i > w_in - 2) x_i = w_in - 2;
+            float x_r = x_f - x_i;
+
+            bilinear_lookup_t* L = &map->L[v * w_out + u];
+            L->I[0] = x_i;
+            L->I[1] = y_i;
+
+            int F[4];
+            F[0] = (int)lroundf((1.0f - x_r) * (1.0f - y_r) * 255.0f);
+            F[1] = (int)lroundf(x_r * (1.0f - y_r) * 255.0f);
+            F[2] = (int)lroundf((1.0f - x_r) * y_r * 255.0f);
+            F[3] = (int)lroundf(x_r * y_r * 255.0f);
+
+            // push the rounding error onto the biggest tap so the sum is exactly 255
+            int largest = 0;
+            for (int i = 1; i < 4; i++) {
+                if (F[i] > F[largest]) largest = i;
+            }
+            F[largest] += 255 - (F[0] + F[1] + F[2] + F[3]);
+
+            for (int i = 0; i < 4; i++) {
+                L->F[i] = (uint8_t)F[i];
+            }
+        }
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void mcv_free_resize_map(undistort_map_t* map) {
+    free(map->L);
+    map->L = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+static inline uint8_t bilinear(const uint8_t* p, int stride, int step, const bilinear_lookup_t* L) {
+    int acc = L->F[0] * p[0] + L->F[1] * p[step] + L->F[2] * p[stride] + L->F[3] * p[stride + step];
+    return (uint8_t)((acc + 127) / 255);
+}
+
+//-----------------------------------------------------------------------------
+
+int mcv_resize_image(const uint8_t* input, uint8_t* output, undistort_map_t* map) {
+    const int w = map->w_in;
+    const int n = map->w_out * map->h_out;
+
+    for (int i = 0; i < n; i++) {
+        const bilinear_lookup_t* L = &map->L[i];
+        output[i] = bilinear(input + L->I[1] * w + L->I[0], w, 1, L);
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int mcv_resize_8uc3_image(const uint8_t* rgb_input, uint8_t* output, undistort_map_t* map) {
+    const int stride = 3 * map->w_in;
+    const int n = map->w_out * map->h_out;
+
+    for (int i = 0; i < n; i++) {
+        const bilinear_lookup_t* L = &map->L[i];
+        const uint8_t* p = rgb_input + L->I[1] * stride + L->I[0] * 3;
+        output[3 * i + 0] = bilinear(p + 0, stride, 3, L);
+        output[3 * i + 1] = bilinear(p + 1, stride, 3, L);
+        output[3 * i + 2] = bilinear(p + 2, stride, 3, L);
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int mcv_resize_yuv422_image(const uint8_t* yuyv_input, uint8_t* output, undistort_map_t* map) {
+    if (map->w_out & 1) {
+        fprintf(stderr, "ERROR: yuv422 resize needs an even output width, got %d\n", map->w_out);
+        return -1;
+    }
+
+    const int stride = 2 * map->w_in;
+    const int n = map->w_out * map->h_out;
+
+    // one output Y0 U Y1 V macropixel per iteration, chroma from the first pixel's source pair
+    for (int i = 0; i < n; i += 2) {
+        const bilinear_lookup_t* L0 = &map->L[i];
+        const bilinear_lookup_t* L1 = &map->L[i + 1];
+        const uint8_t* row0 = yuyv_input + L0->I[1] * stride;
+        const uint8_t* chroma = row0 + (L0->I[0] & ~1) * 2;
+
+        output[2 * i + 0] = bilinear(row0 + L0->I[0] * 2, stride, 2, L0);
+        output[2 * i + 1] = chroma[1];
+        output[2 * i + 2] = bilinear(yuyv_input + L1->I[1] * stride + L1->I[0] * 2, stride, 2, L1);
+        output[2 * i + 3] = chroma[3];
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,35 @@
+#include "result_encode.h"
+#include "onboard_compute.pb.h"
+
+using namespace steeleagle;
+
+//-----------------------------------------------------------------------------
+
+void encode_detections(const DetectionBuffer& detections, const vector<uint32_t>& keep,
+                       const NameTable& names, ComputeResult& result, ostream* log) {
+    for (uint32_t i : keep) {
+        AIDetection* detection_proto = result.add_compute_result();
+
+        const string& class_name = names.Name(detections.class_name[i]);
+        const string& cam = names.Name(detections.cam[i]);
+        if (log) {
+            *log << "Detection from frame " << detections.frame_id[i] << endl;
+            *log << "Class name: " << class_name << "; cam: " << cam << endl;
+        }
+
+        // Set protobuf fields
+        detection_proto->set_timestamp_ns(detections.timestamp_ns[i]);
+        detection_proto->set_class_id(detections.class_id[i]);
+        detection_proto->set_frame_id(detections.frame_id[i]);
+        detection_proto->set_class_name(class_name);
+        detection_proto->set_cam(cam);
+        detection_proto->set_class_confidence(detections.class_confidence[i]);
+        detection_proto->set_detection_confidence(detections.detection_confidence[i]);
+        detection_proto->set_x_min(detections.x_min[i]);
+        detection_proto->set_y_min(detections.y_min[i]);
+        detection_proto->set_x_max(detections.x_max[i]);
+        detection_proto->set_y_max(detections.y_max[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,23 @@
+#ifndef RESULT_ENCODE_H
+#define RESULT_ENCODE_H
+
+#include <stdint.h>
+
+#include <ostream>
+#include <vector>
+
+#include "detection_buffer.h"
+
+using namespace std;
+
+namespace steeleagle {
+class ComputeResult;
+}
+
+// Appends detection i of detections to result for every i in keep, in keep's
+// order, as the server sends them to clients. log, when set, gets the
+// per-detection lines the server prints.
+void encode_detections(const DetectionBuffer& detections, const vector<uint32_t>& keep,
+                       const NameTable& names, steeleagle::ComputeResult& result, ostream* log);
+
+#endif // RESULT_ENCODE_H
@@ -0,0 +1,71 @@
+#include "result_filter.h"
+#include "onboard_compute.pb.h"
+
+#include <algorithm>
+
+using namespace steeleagle;
+
+//-----------------------------------------------------------------------------
+
+void ResultFilter::Configure(const ComputeRequest& request) {
+    min_class_confidence = request.min_class_confidence();
+    min_detection_confidence = request.min_detection_confidence();
+    max_results = request.max_results();
+
+    // Ids no model can produce stay off the table, a list of only those allows nothing
+    class_allowed.clear();
+    filter_classes = request.class_ids_size() > 0;
+    for (int32_t class_id : request.class_ids()) {
+        if (class_id < 0 || class_id >= kMaxClassIds) {
+            continue;
+        }
+        if ((size_t)class_id >= class_allowed.size()) {
+            class_allowed.resize(class_id + 1, 0);
+        }
+        class_allowed[class_id] = 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ResultFilter::Apply(const DetectionBuffer& detections, vector<uint32_t>& keep) const {
+    uint32_t size = detections.Size();
+    keep.resize(size);
+
+    // Without an allow-list every class id is masked down to the single allow-all entry
+    static const uint8_t kAllowAll = 1;
+    const uint8_t* allowed = class_allowed.empty() ? &kAllowAll : class_allowed.data();
+    const uint32_t num_classes = filter_classes ? class_allowed.size() : UINT32_MAX;
+    const uint32_t index_mask = filter_classes ? UINT32_MAX : 0;
+
+    const int32_t* frame_id = detections.frame_id.data();
+    const uint32_t* class_ids = detections.class_id.data();
+    const float* class_confidence = detections.class_confidence.data();
+    const float* detection_confidence = detections.detection_confidence.data();
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t class_id = class_ids[i];
+        // Out of range ids read slot 0 and are then rejected by in_range
+        uint32_t in_range = class_id < num_classes;
+        uint32_t class_ok = in_range & allowed[(class_id * in_range) & index_mask];
+
+        uint32_t pass = (frame_id[i] != -1) &
+                        (class_confidence[i] >= min_class_confidence) &
+                        (detection_confidence[i] >= min_detection_confidence) &
+                        class_ok;
+        keep[n] = i;
+        n += pass;
+    }
+    keep.resize(n);
+
+    if (max_results > 0 && n > (uint32_t)max_results) {
+        auto by_confidence = [&](uint32_t a, uint32_t b) {
+            return detection_confidence[a] > detection_confidence[b];
+        };
+        partial_sort(keep.begin(), keep.begin() + max_results, keep.end(), by_confidence);
+        keep.resize(max_results);
+    }
+}
+
+//-----------------------------------------------------------------------------
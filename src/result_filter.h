@@ -0,0 +1,38 @@
+#ifndef RESULT_FILTER_H
+#define RESULT_FILTER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "detection_buffer.h"
+
+using namespace std;
+
+namespace steeleagle {
+class ComputeRequest;
+}
+
+// Per request confidence / class / top-k filter applied before a result is
+// serialized. The pass test is branch free (comparisons folded with &, class
+// allow-list as a byte table) so the loop compacts indices without
+// mispredicting on noisy detections.
+class ResultFilter {
+ public:
+    void Configure(const steeleagle::ComputeRequest& request);
+
+    // Fills keep with the indices of detections that pass, best first when
+    // max_results is set. Delimiter records never pass.
+    void Apply(const DetectionBuffer& detections, vector<uint32_t>& keep) const;
+
+ private:
+    // Class ids come from the client, the allow-list table stays this small
+    static const int32_t kMaxClassIds = 4096;
+
+    float min_class_confidence = 0.0f;
+    float min_detection_confidence = 0.0f;
+    int max_results = 0;
+    bool filter_classes = false;    // class_ids was set, even if none of them can match
+    vector<uint8_t> class_allowed;  // indexed by class id, up to the largest one allowed
+};
+
+#endif // RESULT_FILTER_H